@@ -0,0 +1,158 @@
+// Block device table.
+//
+// Disk drivers add each disk they find with bdevadd() as
+// they start up. Once processes run, bdevparts() reads the
+// MBR partition table of each disk and adds a device for
+// each partition it lists. A partition shares its disk's
+// driver; the driver adds the partition's start to block
+// numbers.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "bdev.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_DEV
+
+#define SECTOR_SIZE 512
+
+// An entry of the MBR partition table.
+struct mbrpart {
+  uchar status;    // 0x80 if bootable, else 0
+  uchar chs[3];
+  uchar type;      // 0 if unused
+  uchar chsend[3];
+  uint lba;        // first sector
+  uint nsect;
+};
+
+#define MBR_PARTS  446  // offset of the partition table
+#define MBR_NPART  4
+
+// Devices are only added, at boot, so the table
+// needs no lock once processes run.
+static struct bdev bdevs[NBDEV];
+static int nbdev;
+
+static int
+add(char *name, struct bdevops *ops, int unit, uint start, uint size, int part)
+{
+  struct bdev *d;
+
+  if(nbdev == NBDEV){
+    log_warn("too many devices, ignoring %s", name);
+    return -1;
+  }
+  d = &bdevs[nbdev];
+  safestrcpy(d->name, name, sizeof(d->name));
+  d->ops = ops;
+  d->unit = unit;
+  d->start = start;
+  d->size = size;
+  d->part = part;
+  log_info("%s: dev %d, %d blocks", d->name, nbdev, size);
+  return nbdev++;
+}
+
+// Add the disk called name, which has size blocks, and which
+// ops reaches as unit. Returns its device number, or -1.
+int
+bdevadd(char *name, struct bdevops *ops, int unit, uint size)
+{
+  return add(name, ops, unit, 0, size, 0);
+}
+
+// Return device dev, which must exist.
+struct bdev*
+bdevget(uint dev)
+{
+  if(dev >= nbdev)
+    panic("bdevget");
+  return &bdevs[dev];
+}
+
+// Do devices a and b share any blocks, as a disk and its
+// partition or a device and itself do?
+int
+bdevoverlap(uint a, uint b)
+{
+  struct bdev *da, *db;
+
+  da = bdevget(a);
+  db = bdevget(b);
+  return da->ops == db->ops && da->unit == db->unit &&
+         da->start < db->start + db->size && db->start < da->start + da->size;
+}
+
+// Return the number of the device called name, or -1.
+int
+bdevlookup(char *name)
+{
+  int i;
+
+  for(i = 0; i < nbdev; i++)
+    if(strncmp(bdevs[i].name, name, sizeof(bdevs[i].name)) == 0)
+      return i;
+  return -1;
+}
+
+// Choose the root device: the virtio disk if
+// there is one, else ROOTDEV.
+void
+bdevsetroot(void)
+{
+  int dev;
+
+  if((dev = bdevlookup("vda")) < 0 && (dev = bdevlookup(ROOTDEV)) < 0)
+    panic("no root disk");
+  rootdev = dev;
+  log_info("root is %s", bdevs[dev].name);
+}
+
+// Add the partitions of each disk. Partitions must start
+// and end on block boundaries, and lie within the disk.
+// Reads from disk, so must be called from a process.
+void
+bdevparts(void)
+{
+  struct mbrpart *parts, *p;
+  struct buf *bp;
+  struct bdev *d;
+  char name[8];
+  int i, j, k, n, spb;
+
+  spb = BSIZE / SECTOR_SIZE;
+  n = nbdev;
+  for(i = 0; i < n; i++){
+    d = &bdevs[i];
+    if(d->part != 0 || d->size == 0)
+      continue;
+    bp = bread(i, 0);
+    if(bp->data[510] != 0x55 || bp->data[511] != 0xaa){
+      brelse(bp);
+      continue;
+    }
+    parts = (struct mbrpart*)(bp->data + MBR_PARTS);
+    for(j = 0; j < MBR_NPART; j++){
+      p = &parts[j];
+      if(p->type == 0 || p->nsect == 0 || (p->status & 0x7f) != 0)
+        continue;
+      if(p->lba % spb || p->nsect % spb || p->lba / spb >= d->size ||
+         p->nsect / spb > d->size - p->lba / spb){
+        log_warn("%s: partition %d not usable", d->name, j + 1);
+        continue;
+      }
+      safestrcpy(name, d->name, sizeof(name) - 1);
+      k = strlen(name);
+      name[k] = '1' + j;
+      name[k+1] = 0;
+      add(name, d->ops, d->unit, d->start + p->lba / spb, p->nsect / spb, j + 1);
+    }
+    brelse(bp);
+  }
+}
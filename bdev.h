@@ -0,0 +1,17 @@
+// Block devices: whole disks, and the partitions on them.
+// A buf's dev is the index of its device in the table.
+
+// Driver entry points, shared by a disk and its partitions.
+struct bdevops {
+  void (*start)(struct buf*);  // start a request (see iderwstart)
+  void (*wait)(struct buf*);   // wait for its buf to finish
+};
+
+struct bdev {
+  char name[8];        // hda, hda1, vda, ...
+  struct bdevops *ops;
+  int unit;            // which of the driver's disks
+  uint start;          // first block on that disk
+  uint size;           // blocks
+  int part;            // partition number, or 0 for the whole disk
+};
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -9,140 +9,521 @@
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
+// * To have many blocks in flight, start each with bread_async
+//     or bwrite_async, then call bwait on each before using it.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// The implementation uses these state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: the disk driver releases the buffer, by calling
+//     biodone, when the request finishes.
+// * B_AHEAD: the block was read ahead and not yet used.
+//
+// Buffers are hashed by (dev, blockno) into buckets, each with
+// its own lock, so lookups of different blocks on different
+// CPUs do not contend. Unreferenced buffers are also on an LRU
+// list, with its own lock, from which misses pick a buffer to
+// recycle. The cache starts with NBUF buffers; once all memory
+// is free for allocation, binit2() grows it to 1/BCACHEFRAC of
+// free memory. After that it grows a page at a time from free
+// memory, up to NBUFMAX buffers, as long as enough memory
+// remains free for everything else.
+//
+// Lock order: bcache.evictlock, then bucket locks, then
+// bcache.lrulock. Only the holder of evictlock may hold two
+// bucket locks, so bucket locks need no order among themselves.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bdev.h"
+#include "iostat.h"
+#include "loglevel.h"
 
-struct {
+#define LOGSYS LOGSYS_BIO
+
+#define NBUCKET 61
+#define BRESERVE 512  // pages the cache leaves free when growing
+#define NBIOCHAIN 32  // max blocks in one disk request
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through hnext
+};
 
-  // Linked list of all buffers, through prev/next.
+struct {
+  struct spinlock evictlock;  // serializes misses
+  struct spinlock lrulock;
+  struct bucket bucket[NBUCKET];
+  struct buf *spare;   // buffers with data, not yet used
+  int nbuf;            // buffers with data allocated
+  struct buf buf[NBUFMAX];
+
+  // Linked list of unreferenced buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
 } bcache;
 
+struct iostat iostat;
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 1009 + blockno) % NBUCKET];
+}
+
+// Give a page of memory to the cache, as PGSIZE/BSIZE
+// spare buffers. Caller holds bcache.evictlock, or is binit().
+static int
+bgrow(void)
+{
+  char *mem;
+  struct buf *b;
+  int i;
+
+  if(bcache.nbuf + PGSIZE/BSIZE > NBUFMAX)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return 0;
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    b = &bcache.buf[bcache.nbuf++];
+    b->data = (uchar*)mem + i*BSIZE;
+    b->hnext = bcache.spare;
+    bcache.spare = b;
+  }
+  return 1;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evictlock, "bcache.evict");
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  while(bcache.nbuf < NBUF)
+    if(!bgrow())
+      panic("binit");
+}
+
+// Size the cache from free memory. Called from main()
+// after kinit2() has freed the rest of physical memory.
+void
+binit2(void)
+{
+  int want;
+
+  want = kfreecount() / BCACHEFRAC * (PGSIZE/BSIZE);
+  if(want > NBUFMAX)
+    want = NBUFMAX;
+  acquire(&bcache.evictlock);
+  while(bcache.nbuf < want && bgrow())
+    ;
+  release(&bcache.evictlock);
+  log_info("bcache: %d buffers", bcache.nbuf);
+}
+
+// Remove b from the LRU list. Caller holds b's bucket lock.
+static void
+lrudel(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->prev = b->next = 0;
+  release(&bcache.lrulock);
+}
+
+// Find the block in bucket bk and take a reference to it.
+// Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(b->refcnt++ == 0)
+        lrudel(b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Find an unreferenced buffer to recycle: a spare one,
+// a new one if the cache may grow, or else the least
+// recently used one. Remove it from its bucket and
+// return it. Caller holds bcache.evictlock and bk->lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b, **pp;
+  struct bucket *vb;
+
+  if(bcache.spare == 0 && kfreecount() > BRESERVE)
+    bgrow();
+  if((b = bcache.spare) != 0){
+    bcache.spare = b->hnext;
+    return b;
+  }
+
+  for(;;){
+    // Blocks that log.c has modified but not yet installed
+    // are pinned with bpin(), so are not on the list.
+    acquire(&bcache.lrulock);
+    b = bcache.head.prev;
+    release(&bcache.lrulock);
+    if(b == &bcache.head)
+      panic("bget: no buffers");
+
+    // b cannot move to another bucket, since only
+    // evictlock holders do that, but it may have
+    // been referenced since we dropped lrulock.
+    vb = bhash(b->dev, b->blockno);
+    if(vb != bk)
+      acquire(&vb->lock);
+    if(b->refcnt == 0){
+      if(b->flags & B_AHEAD)
+        __sync_fetch_and_add(&iostat.nrawasted, 1);
+      lrudel(b);
+      for(pp = &vb->head; *pp != b; pp = &(*pp)->hnext)
+        ;
+      *pp = b->hnext;
+      if(vb != bk)
+        release(&vb->lock);
+      return b;
+    }
+    if(vb != bk)
+      release(&vb->lock);
   }
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
-//
-// 1st call: alltraps() forkret() iinit(ROOTDEV) readsb(ROOTDEV, &sb) bread(ROOTDEV, 1)
+// In either case, return the buffer with a reference
+// taken but not locked; if ahead is set, return 0
+// instead if the block is already cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bgetref(uint dev, uint blockno, int ahead)
 {
+  struct bucket *bk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  acquire(&bk->lock);
+  for(b = bk->head; ahead && b; b = b->hnext)
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      release(&bk->lock);
+      return 0;
     }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      // Note that the assignment to flags clears B_VALID, thus ensuring
-      // that bread will read the block data from disk rather than incorrectly using the buffer’s
-      // previous contents.
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Look again holding evictlock, in case
+  // another CPU read the block in meanwhile.
+  acquire(&bcache.evictlock);
+  acquire(&bk->lock);
+  if(ahead){
+    for(b = bk->head; b; b = b->hnext)
+      if(b->dev == dev && b->blockno == blockno)
+        break;
+    if(b){
+      release(&bk->lock);
+      release(&bcache.evictlock);
+      return 0;
     }
   }
-  panic("bget: no buffers");
+  if((b = bfind(bk, dev, blockno)) == 0){
+    b = bvictim(bk);
+    b->dev = dev;
+    b->blockno = blockno;
+    // Note that the assignment to flags clears B_VALID, thus ensuring
+    // that bread will read the block data from disk rather than incorrectly using the buffer’s
+    // previous contents.
+    b->flags = 0;
+    b->refcnt = 1;
+    b->hnext = bk->head;
+    bk->head = b;
+  }
+  release(&bk->lock);
+  release(&bcache.evictlock);
+  return b;
 }
 
-// Return a locked buf with the contents of the indicated block.
+// Return the locked buffer for block on device dev,
+// without reading it from disk unless it is cached.
+// For callers that will overwrite the whole block.
+//
+// 1st call: alltraps() forkret() iinit(ROOTDEV) readsb(ROOTDEV, &sb) bread(ROOTDEV, 1)
 struct buf*
-bread(uint dev, uint blockno)
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bgetref(dev, blockno, 0);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Return a locked buf for a block that the caller will
+// overwrite in full, without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Pass the request for b to the driver of b's disk.
+static void
+diskstart(struct buf *b)
+{
+  bdevget(b->dev)->ops->start(b);
+}
+
+static void
+diskwait(struct buf *b)
+{
+  bdevget(b->dev)->ops->wait(b);
+}
+
+// Return a locked buf for the indicated block, having
+// started to read it from disk if it is not cached, without
+// waiting for the disk. Call bwait() before using the data.
+// Many reads can be in flight at once this way.
+struct buf*
+bread_async(uint dev, uint blockno)
 {
   struct buf *b;
 
+  __sync_fetch_and_add(&iostat.nbread, 1);
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    diskstart(b);
+  } else {
+    __sync_fetch_and_add(&iostat.nbhit, 1);
+    if(b->flags & B_AHEAD)
+      __sync_fetch_and_add(&iostat.nrahit, 1);
   }
+  b->flags &= ~B_AHEAD;
   return b;
 }
 
-// Write b's contents to disk.  Must be locked.
+// Return a locked buf with the contents of the indicated block.
+struct buf*
+bread(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bread_async(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// Start reading blocks blockno through blockno+n-1 into the
+// cache, skipping those there already, and return without
+// waiting for the disk. Each run of blocks not in the cache
+// goes to the disk as one request, up to NBIOCHAIN blocks.
 void
-bwrite(struct buf *b)
+breadahead(uint dev, uint blockno, uint n)
+{
+  struct buf *b, *head, *tail;
+  int len;
+
+  head = tail = 0;
+  len = 0;
+  for(; n > 0; n--, blockno++){
+    if((b = bgetref(dev, blockno, 1)) != 0){
+      acquiresleep(&b->lock);
+      if(b->flags & B_VALID){
+        // Someone else read it in first.
+        brelse(b);
+        b = 0;
+      }
+    }
+    if(b != 0){
+      __sync_fetch_and_add(&iostat.nraissued, 1);
+      b->flags |= B_ASYNC|B_AHEAD;
+      b->mnext = 0;
+      if(head == 0)
+        head = b;
+      else
+        tail->mnext = b;
+      tail = b;
+      len++;
+    }
+    if(head != 0 && (b == 0 || len == NBIOCHAIN || n == 1)){
+      diskstart(head);
+      head = 0;
+      len = 0;
+    }
+  }
+}
+
+// Start writing b's contents to disk, and return without
+// waiting for the disk. Must be locked. Call bwait() before
+// changing the data again or releasing b.
+void
+bwrite_async(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
-    panic("bwrite");
+    panic("bwrite_async");
   b->flags |= B_DIRTY;
-  iderw(b);
+  diskstart(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the MRU list.
+// Write b's contents to disk.  Must be locked.
 void
-brelse(struct buf *b)
+bwrite(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
-    panic("brelse");
+  bwrite_async(b);
+  bwait(b);
+}
 
-  releasesleep(&b->lock);
+// Wait for the read or write of b started by
+// bread_async() or bwrite_async() to finish.
+void
+bwait(struct buf *b)
+{
+  if((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    diskwait(b);
+}
+
+// Write the contents of the n locked bufs in bs to disk.
+// Runs of bufs with consecutive block numbers on the same
+// device go to the disk as one request, up to NBIOCHAIN
+// blocks each; callers sort bs to make the runs long.
+// All requests are queued before waiting for any.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i, j;
 
-  acquire(&bcache.lock);
+  for(i = 0; i < n; i = j){
+    for(j = i; j < n; j++){
+      if(!holdingsleep(&bs[j]->lock))
+        panic("bwritev");
+      bs[j]->flags |= B_DIRTY;
+      bs[j]->mnext = 0;
+      if(j > i){
+        if(j - i == NBIOCHAIN || bs[j]->dev != bs[i]->dev ||
+           bs[j]->blockno != bs[j-1]->blockno + 1)
+          break;
+        bs[j-1]->mnext = bs[j];
+      }
+    }
+    diskstart(bs[i]);
+  }
+  for(i = 0; i < n; i++)
+    bwait(bs[i]);
+}
+
+// Drop a reference to b.
+// Move to the head of the MRU list if it was the last one.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
+    acquire(&bcache.lrulock);
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     bcache.head.next->prev = b;
     bcache.head.next = b;
+    release(&bcache.lrulock);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Release a locked buffer.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Keep b in the cache after the caller releases it,
+// until a matching bunpin(). Used by the log for blocks
+// that must stay cached until installed.
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt++;
+  release(&bk->lock);
+}
+
+void
+bunpin(struct buf *b)
+{
+  bunref(b);
+}
+
+// Called by the disk driver, possibly from an interrupt
+// handler, for each buf of a request that has finished.
+// Wakes the process waiting in bwait(), or, if B_ASYNC
+// is set, releases b on behalf of the process that
+// started the request.
+void
+biodone(struct buf *b)
+{
+  b->mnext = 0;
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    releasesleep(&b->lock);
+    bunref(b);
+  } else
+    wakeup(b);
+}
+
+// Fill in the buffer cache part of *st.
+void
+biostat(struct iostat *st)
+{
+  *st = iostat;
+  st->nbuf = bcache.nbuf;
 }
 //PAGEBREAK!
 // Blank page.
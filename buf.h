@@ -6,9 +6,14 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash bucket chain
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  struct buf *mnext; // next block in a multi-block request
+  uint qtime;        // ticks when queued
+  uchar *data;       // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // release buffer when I/O completes
+#define B_AHEAD 0x10 // read ahead, not yet used
 
@@ -8,15 +8,22 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "fs.h"
 #include "file.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "loglevel.h"
 
 static void consputc(int);
 
+// Runtime log level of each subsystem, set by sys_loglevel().
+int loglevels[NLOGSYS] = {
+  [0 ... NLOGSYS-1] = LOGLEVEL,
+};
+
 static int panicked = 0;
 
 static struct {
@@ -176,6 +183,8 @@ panic(char *s)
 
   cli();
   cons.locking = 0;
+  uartpoll();   // no more transmit interrupts
+  klogflush();  // messages logged before the panic
   // use lapiccpunum so that we can call panic from mycpu()
   cprintf("lapicid %d: panic: ", lapicid());
   cprintf(s);
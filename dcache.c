@@ -0,0 +1,288 @@
+// Directory entry cache.
+//
+// The dcache remembers the results of directory lookups,
+// mapping (dev, directory inum, name) to the inum the name
+// refers to and the offset of its directory entry, so that
+// dirlookup() need not scan the directory, and namex() can
+// resolve cached path components without locking directory
+// inodes at all. Failed lookups are cached too, as negative
+// entries with inum 0, since the shell and exec() probe for
+// many names that do not exist.
+//
+// Lookups take no locks: they run inside an RCU read-side
+// section and follow the hash chains directly. Insertions
+// and removals are serialized by dcache.lock. A removed or
+// evicted entry keeps its next pointer, so a reader standing
+// on it can keep walking the chain, and it is not reused
+// until rcusync() shows that no reader can still see it.
+//
+// Since a lookup does not lock the inode it returns, a
+// concurrent unlink could free that inode before the caller
+// takes a reference to it. Removals therefore bump dcache.seq,
+// and a lockless walk is only trusted if the sequence number
+// did not change between dcachebegin() and dcacheretry().
+//
+// Callers keep the cache in step with the disk while holding
+// the directory's lock: dirlookup() enters what it finds,
+// dirlink() turns a negative entry positive, unlink turns a
+// positive entry negative, and create() purges entries left
+// over from an earlier directory with the same inum.
+// "." and ".." are never cached.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDHASH 61
+
+struct dentry {
+  struct dentry *next;   // hash chain, followed by lockless readers
+  struct dentry *free;   // free or retired list
+  int inuse;             // on a hash chain?
+  uint dev;
+  uint dinum;            // directory containing the name
+  char name[DIRSIZ];
+  uint inum;             // inode the name refers to, or 0 if none
+  uint off;              // offset of the directory entry
+};
+
+struct {
+  struct spinlock lock;
+  uint seq;              // odd while a removal is in progress
+  struct dentry *hash[NDHASH];
+  struct dentry *free;   // ready for reuse
+  struct dentry *retired; // waiting for a grace period
+  struct dentry *hand;   // next eviction candidate
+  struct dentry entry[NDENTRY];
+} dcache;
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++){
+    d->free = dcache.free;
+    dcache.free = d;
+  }
+  dcache.hand = dcache.entry;
+}
+
+static uint
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDHASH;
+}
+
+// Unlink d from its hash chain and retire it.
+// Caller holds dcache.lock.
+static void
+dunlink(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      d->inuse = 0;
+      d->free = dcache.retired;
+      dcache.retired = d;
+      return;
+    }
+  }
+  panic("dunlink");
+}
+
+// Return a free entry, evicting and waiting for a
+// grace period if there is none.
+// Called with dcache.lock held; may release and reacquire it.
+static struct dentry*
+dalloc(void)
+{
+  struct dentry *d, *r;
+  int n;
+
+  while(dcache.free == 0){
+    // Evict a batch of entries, round robin, so that
+    // one grace period frees several of them.
+    for(n = 0; n < NDENTRY && (dcache.retired == 0 || n < NDENTRY/8); n++){
+      d = dcache.hand;
+      if(++dcache.hand == dcache.entry+NDENTRY)
+        dcache.hand = dcache.entry;
+      if(d->inuse)
+        dunlink(d);
+    }
+    r = dcache.retired;
+    dcache.retired = 0;
+    release(&dcache.lock);
+    rcusync();
+    acquire(&dcache.lock);
+    while(r){
+      d = r;
+      r = r->free;
+      d->free = dcache.free;
+      dcache.free = d;
+    }
+  }
+  d = dcache.free;
+  dcache.free = d->free;
+  return d;
+}
+
+// Find the entry for name in directory dinum.
+// Caller holds dcache.lock or is in an RCU read-side section.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dinum, name)]; d; d = d->next)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Look up name in directory dinum on dev.
+// On a hit, store the inum, or 0 if the name does not
+// exist, in *inum and return 1.
+// Caller must be in an RCU read-side section.
+int
+dcachelookup(uint dev, uint dinum, char *name, uint *inum)
+{
+  struct dentry *d;
+
+  if((d = dfind(dev, dinum, name)) == 0)
+    return 0;
+  *inum = d->inum;
+  return 1;
+}
+
+// Look up name in directory dp for dirlookup().
+// On a hit, store the inum (0 if the name does not exist)
+// and the directory entry offset, and return 1.
+// Caller holds dp->lock.
+int
+dcacheget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int r;
+
+  r = 0;
+  rcureadlock();
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    *off = d->off;
+    *inum = d->inum;
+    r = 1;
+  }
+  rcureadunlock();
+  return r;
+}
+
+// Remember that name in directory dp refers to inum,
+// with its entry at offset off, or that it does not
+// exist if inum is 0.
+// Caller holds dp->lock, for writing if the name was
+// just added.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    return;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = dalloc();
+    // dalloc() may have dropped the lock.
+    if(dfind(dp->dev, dp->inum, name) != 0){
+      d->free = dcache.free;
+      dcache.free = d;
+      d = dfind(dp->dev, dp->inum, name);
+    }
+  }
+  if(d->inuse){
+    // Readers see either the old inum or the new one.
+    d->off = off;
+    d->inum = inum;
+    release(&dcache.lock);
+    return;
+  }
+  d->dev = dp->dev;
+  d->dinum = dp->inum;
+  strncpy(d->name, name, DIRSIZ);
+  d->inum = inum;
+  d->off = off;
+  d->inuse = 1;
+  d->next = dcache.hash[dhash(d->dev, d->dinum, d->name)];
+  // Readers must not see d before it is filled in.
+  __sync_synchronize();
+  dcache.hash[dhash(d->dev, d->dinum, d->name)] = d;
+  release(&dcache.lock);
+}
+
+// Record that name in directory dp is about to be removed.
+// Caller holds dp->lock for writing.
+void
+dcacheremove(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  // Bump seq even if name is not cached: a reader may
+  // have found it before it was evicted.
+  dcache.seq++;
+  __sync_synchronize();
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    d->inum = 0;
+  __sync_synchronize();
+  dcache.seq++;
+  release(&dcache.lock);
+}
+
+// Drop all entries for names in directory dp, which has
+// just been allocated: any that remain describe a directory
+// that earlier had the same inum.
+void
+dcachepurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++)
+    if(d->inuse && d->dev == dp->dev && d->dinum == dp->inum)
+      dunlink(d);
+  release(&dcache.lock);
+}
+
+// Start a lockless walk; pass the result to dcacheretry().
+uint
+dcachebegin(void)
+{
+  uint seq;
+
+  seq = dcache.seq;
+  __sync_synchronize();
+  return seq;
+}
+
+// Was an entry removed since dcachebegin() returned seq?
+// If so, results of the walk cannot be trusted.
+int
+dcacheretry(uint seq)
+{
+  __sync_synchronize();
+  return (seq & 1) || dcache.seq != seq;
+}
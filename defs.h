@@ -17,23 +17,51 @@ breakpoint1(void *a1)
   (void)a1;
 }
 
+struct bdev;
+struct bdevops;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
+struct lockstat;
+struct lsclass;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct rwsleeplock;
+struct rwspinlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
 
+// bdev.c
+int             bdevadd(char*, struct bdevops*, int, uint);
+struct bdev*    bdevget(uint);
+int             bdevlookup(char*);
+int             bdevoverlap(uint, uint);
+void            bdevparts(void);
+void            bdevsetroot(void);
+
 // bio.c
 void            binit(void);
+void            binit2(void);
+struct buf*     bget(uint, uint);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
 void            brelse(struct buf*);
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
+void            bwritev(struct buf**, int);
+struct buf*     bnew(uint, uint);
+void            bpin(struct buf*);
+void            bunpin(struct buf*);
+void            breadahead(uint, uint, uint);
+void            biodone(struct buf*);
+void            biostat(struct iostat*);
 
 // console.c
 void            consoleinit(void);
@@ -41,9 +69,36 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
-#define log_warn(fmt, ...) cprintf("%0\x1b[33m W %s " fmt "\x1b[0m\n", __func__, ##__VA_ARGS__)
-#define log_info(fmt, ...) cprintf("%0\x1b[34m I %s " fmt "\x1b[0m\n", __func__, ##__VA_ARGS__)
-#define log_debug(fmt, ...) cprintf("%0\x1b[37m D %s " fmt "\x1b[0m\n", __func__, ##__VA_ARGS__)
+extern int      loglevels[];
+
+// Log a message at level lvl for the file's subsystem, LOGSYS.
+// Levels below LOGLEVEL compile to nothing; the rest are checked
+// against the subsystem's runtime level and appended to the
+// CPU's log ring (klog.c). Files that log include loglevel.h
+// and define LOGSYS.
+#define klog(lvl, pfx, fmt, ...) do { \
+    if((lvl) >= LOGLEVEL && (lvl) >= loglevels[LOGSYS]) \
+      klogf(pfx " %s " fmt "\x1b[0m\n", __func__, ##__VA_ARGS__); \
+  } while(0)
+#define log_warn(fmt, ...) klog(LOG_WARN, "\x1b[33m W", fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...) klog(LOG_INFO, "\x1b[34m I", fmt, ##__VA_ARGS__)
+#define log_debug(fmt, ...) klog(LOG_DEBUG, "\x1b[37m D", fmt, ##__VA_ARGS__)
+
+// klog.c
+void            klogf(char*, ...);
+void            klogflush(void);
+void            klogd(void);
+int             klogcopy(char*, int);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(uint, uint, char*, uint*);
+int             dcacheget(struct inode*, char*, uint*, uint*);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcacheremove(struct inode*, char*);
+void            dcachepurge(struct inode*);
+uint            dcachebegin(void);
+int             dcacheretry(uint);
 
 // exec.c
 int             exec(char*, char**);
@@ -58,28 +113,37 @@ int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
+extern uint     rootdev;
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
+int             fsmount(uint, struct inode*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
+int             ismounted(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            readahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
 void            iderw(struct buf*);
+void            iderwstart(struct buf*);
+void            iderwwait(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -91,6 +155,7 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+int             kfreecount(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -105,15 +170,29 @@ void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
 // log.c
-void            initlog(int dev);
+int             initlog(int, struct superblock*);
+void            loginit(void);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            begin_opn(int);
+void            end_opn(int);
+int             logmaxop(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+void            pcienable(struct pcidev*);
+struct pcidev*  pcifind(uint, uint);
+void            pciinit(void);
+int             pciintr(int);
+struct pcidev*  pcilookup(uint, uint);
+uint            pciread(uint, uint);
+int             pcisetintr(struct pcidev*, void (*)(void));
+void            pciwrite(uint, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -123,6 +202,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -140,6 +221,7 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+struct proc*    kproc(char*, void(*)(void));
 int             wait(void);
 #if 0
 void            wakeup(void*);
@@ -159,12 +241,39 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
+struct lsclass* lsregister(char*, int);
+void            lsacquire(struct lsclass*, int, uint64, uint);
+void            lsrelease(struct lsclass*, uint64);
+int             lockstatcopy(struct lockstat*, int, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+int             ownerrunning(struct proc*);
+void            disownsleep(struct sleeplock*);
+
+// rcu.c
+void            rcureadlock(void);
+void            rcureadunlock(void);
+void            rcuquiescent(void);
+void            rcusync(void);
+
+// rwlock.c
+void            initrwlock(struct rwspinlock*, char*);
+void            acquireread(struct rwspinlock*);
+void            releaseread(struct rwspinlock*);
+void            acquirewrite(struct rwspinlock*);
+void            releasewrite(struct rwspinlock*);
+int             holdingwrite(struct rwspinlock*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquirereadsleep(struct rwsleeplock*);
+void            releasereadsleep(struct rwsleeplock*);
+void            acquirewritesleep(struct rwsleeplock*);
+void            releasewritesleep(struct rwsleeplock*);
+void            downgradesleep(struct rwsleeplock*);
+int             holdingwritesleep(struct rwsleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -195,8 +304,12 @@ extern struct spinlock tickslock;
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
+void            uartpoll(void);
 void            uartputc(int);
 
+// virtio.c
+void            virtioinit(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
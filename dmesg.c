@@ -0,0 +1,67 @@
+// Print the kernel log.
+//
+// usage: dmesg
+//
+// The kernel returns each CPU's messages in turn;
+// dmesg merges them in order of their timestamps.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define LOGBYTES (NCPU*KLOGSIZE + 1)
+#define NLINE (LOGBYTES/8)
+
+char buf[LOGBYTES];
+char *lines[NLINE];
+uint stamps[NLINE];
+
+// The tick count at the start of a line, "[ticks] ...".
+uint
+stamp(char *s)
+{
+  if(*s != '[')
+    return 0;
+  return atoi(s+1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, nline, i, j;
+  char *p, *t;
+  uint st;
+
+  if(argc > 1){
+    printf(2, "usage: dmesg\n");
+    exit();
+  }
+  if((n = dmesg(buf, sizeof(buf))) < 0){
+    printf(2, "dmesg: dmesg failed\n");
+    exit();
+  }
+
+  // Split into lines, and insert each in order of its
+  // timestamp, after lines with the same one.
+  nline = 0;
+  for(p = buf; p < buf + n && nline < NLINE; p = t + 1){
+    if((t = strchr(p, '\n')) == 0)
+      break;
+    *t = 0;
+    st = stamp(p);
+    for(i = nline; i > 0 && stamps[i-1] > st; i--)
+      ;
+    for(j = nline; j > i; j--){
+      lines[j] = lines[j-1];
+      stamps[j] = stamps[j-1];
+    }
+    lines[i] = p;
+    stamps[i] = st;
+    nline++;
+  }
+
+  for(i = 0; i < nline; i++)
+    printf(1, "%s\n", lines[i]);
+  exit();
+}
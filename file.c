@@ -8,6 +8,7 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
@@ -92,6 +93,40 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Sequential readahead for a read of n bytes at f->off.
+// Each read that starts where the last one ended doubles
+// the readahead window, up to NREADAHEAD blocks; any other
+// read closes it. Blocks past the ones this read needs and
+// within the window are started without waiting.
+// Caller holds f->ip->lock.
+static void
+fileahead(struct file *f, int n)
+{
+  uint first, end;
+
+  if(f->off != f->raoff || n <= 0){
+    f->rawin = 0;
+    f->ranext = 0;
+    return;
+  }
+  if(f->rawin == 0)
+    f->rawin = 4;
+  else if(f->rawin < NREADAHEAD)
+    f->rawin *= 2;
+  if(f->rawin > NREADAHEAD)
+    f->rawin = NREADAHEAD;
+
+  // readi() reads the first block itself.
+  first = f->off/BSIZE + 1;
+  end = (f->off + n + BSIZE - 1)/BSIZE + f->rawin;
+  if(first < f->ranext)
+    first = f->ranext;
+  if(first < end){
+    readahead(f->ip, first, end - first);
+    f->ranext = end;
+  }
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -104,8 +139,10 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
+    fileahead(f, n);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->raoff = f->off;
     iunlock(f->ip);
     return r;
   }
@@ -130,19 +167,20 @@ filewrite(struct file *f, char *addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int nop = logmaxop();
+    int max = ((nop-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nop);
       ilock(f->ip);
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r < 0)
         break;
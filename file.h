@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;   // offset where a sequential read would start
+  uint rawin;   // readahead window, in blocks
+  uint ranext;  // next block to read ahead
 };
 
 
@@ -14,7 +17,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  struct inode *hnext;  // hash chain
+  struct inode *lprev;  // LRU list of unreferenced inodes
+  struct inode *lnext;
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
@@ -22,7 +28,8 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NADDRS];
+  uint lastblk;       // block last allocated, goal for the next
 };
 
 // table mapping major device number to
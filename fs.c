@@ -15,23 +15,53 @@
 #include "stat.h"
 #include "mmu.h"
 #include "proc.h"
+#include "x86.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bdev.h"
 #include "file.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_FS
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+
+// Device holding the root file system, set by bdevsetroot().
+uint rootdev;
+
+// Each file system in use: the root, and those mounted on
+// directories of other file systems. Besides the superblock
+// it records in-memory allocation state: where balloc() and
+// ialloc() should start looking, and how many blocks are free.
+// The hints are only hints; the bitmap and the dinodes
+// are the truth, protected by their buffer locks.
+// Entries are added by fsattach() and never removed.
+struct fsdev {
+  uint dev;
+  int used;
+  struct superblock sb;
+  struct inode *covered;  // directory mounted on, or 0 for the root
+  uint bhint;  // block to start searching from
+  uint ihint;  // inum to start searching from
+  int nfree;   // free blocks
+};
+
+struct {
+  struct spinlock lock;
+  struct fsdev dev[NMOUNT];
+  int nmount;  // entries with covered set
+  struct sleeplock attachlock;  // one fsattach() at a time
+} fsalloc;
 
 // Read the super block.
 void
 readsb(int dev, struct superblock *sb)
 {
-  log_info("dev:%d (must ==1 ROOTDEV) sb:%p", dev, sb);
+  log_info("dev:%d sb:%p", dev, sb);
   struct buf *bp;
 
   bp = bread(dev, 1);
@@ -45,7 +75,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -53,27 +83,202 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Count the free blocks in the bitmap of the
+// file system on dev, which has superblock sb.
+static int
+bcount(uint dev, struct superblock *sb)
 {
-  int b, bi, m;
+  int b, bi, n;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
+  n = 0;
+  for(b = 0; b < sb->size; b += BPB){
+    bp = bread(dev, BBLOCK(b, (*sb)));
+    for(bi = 0; bi < BPB && b + bi < sb->size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        n++;
+    brelse(bp);
+  }
+  return n;
+}
+
+// Start using the file system on dev, as the root if covered
+// is 0, else mounted on directory covered. Returns -1 if dev
+// holds no file system this kernel can use, or shares blocks
+// with a device in use already, or too many file systems are.
+// The superblock may come from any disk a user names, so check
+// that the log, the inodes and the bitmap lie within the file
+// system. The file system's log is recovered before its free
+// blocks are counted, since it may hold bitmap updates.
+static int
+fsattach(uint dev, struct inode *covered)
+{
+  struct superblock sb;
+  struct fsdev *d, *fd;
+  int n;
+
+  if(bdevget(dev)->size < 2)
+    return -1;
+  readsb(dev, &sb);
+  if(sb.bsize != BSIZE || sb.size > bdevget(dev)->size ||
+     sb.ninodes < 2 || sb.bmapstart >= sb.size ||
+     sb.bmapstart + sb.size/BPB >= sb.size ||
+     sb.inodestart > sb.bmapstart ||
+     sb.ninodes/IPB > sb.bmapstart - sb.inodestart ||
+     sb.logstart < 2 || sb.logstart > sb.inodestart ||
+     sb.nlog > sb.inodestart - sb.logstart)
+    return -1;
+
+  // With one attach at a time, the free entry found
+  // here is still free once the log is recovered.
+  acquiresleep(&fsalloc.attachlock);
+  acquire(&fsalloc.lock);
+  fd = 0;
+  for(d = fsalloc.dev; d < fsalloc.dev+NMOUNT; d++){
+    if(d->used && (bdevoverlap(d->dev, dev) ||
+                   (covered && d->covered == covered)))
+      break;
+    if(fd == 0 && !d->used)
+      fd = d;
+  }
+  release(&fsalloc.lock);
+  if(d < fsalloc.dev+NMOUNT || fd == 0 || initlog(dev, &sb) < 0){
+    releasesleep(&fsalloc.attachlock);
+    return -1;
+  }
+  n = bcount(dev, &sb);
+
+  acquire(&fsalloc.lock);
+  fd->used = 1;
+  fd->dev = dev;
+  fd->sb = sb;
+  fd->covered = covered;
+  fd->bhint = 0;
+  fd->ihint = 1;
+  fd->nfree = n;
+  if(covered)
+    fsalloc.nmount++;
+  release(&fsalloc.lock);
+  releasesleep(&fsalloc.attachlock);
+  return 0;
+}
+
+// Return the state of the file system on dev.
+static struct fsdev*
+fsdev(uint dev)
+{
+  struct fsdev *d;
+
+  acquire(&fsalloc.lock);
+  for(d = fsalloc.dev; d < fsalloc.dev+NMOUNT; d++){
+    if(d->used && d->dev == dev){
+      release(&fsalloc.lock);
+      return d;
+    }
+  }
+  panic("fsdev: not mounted");
+}
+
+// Mount the file system on dev on directory dp, which
+// takes over the caller's reference to dp. The caller must
+// not be in a transaction, see initlog(). Returns -1
+// if dp is not a directory or is a file system's root,
+// or if fsattach() fails.
+int
+fsmount(uint dev, struct inode *dp)
+{
+  int ok;
+
+  ilock(dp);
+  ok = dp->type == T_DIR && dp->inum != ROOTINO;
+  iunlock(dp);
+  if(!ok || fsattach(dev, dp) < 0)
+    return -1;
+  return 0;
+}
+
+// The file system mounted on the directory (dev, inum), or 0.
+static struct fsdev*
+mountedon(uint dev, uint inum)
+{
+  struct fsdev *d;
+
+  if(fsalloc.nmount == 0)
+    return 0;
+  acquire(&fsalloc.lock);
+  for(d = fsalloc.dev; d < fsalloc.dev+NMOUNT; d++){
+    if(d->used && d->covered &&
+       d->covered->dev == dev && d->covered->inum == inum){
+      release(&fsalloc.lock);
+      return d;
+    }
+  }
+  release(&fsalloc.lock);
+  return 0;
+}
+
+// Is a file system mounted on ip?
+int
+ismounted(struct inode *ip)
+{
+  return mountedon(ip->dev, ip->inum) != 0;
+}
+
+// Allocate a disk block, zeroed if zero is set. Searches
+// the bitmap a word at a time, starting from goal, usually
+// the block after the file's previous one, so that files
+// are laid out sequentially. With no goal, starts where the
+// last such allocation left off, and moves that point BGAP
+// blocks on, leaving room for the file to grow into.
+#define BGAP 8
+
+static uint
+balloc(uint dev, uint goal, int zero)
+{
+  struct fsdev *d;
+  struct buf *bp;
+  uint b, start, *w;
+  int wi, bi, n;
+
+  d = fsdev(dev);
+  acquire(&fsalloc.lock);
+  if(d->nfree == 0){
+    release(&fsalloc.lock);
+    panic("balloc: out of blocks");
+  }
+  start = goal ? goal : d->bhint;
+  if(start >= d->sb.size)
+    start = 0;
+  release(&fsalloc.lock);
+
+  // Visit every bitmap block once, starting with the hint's
+  // and coming back to it at the end for the bits before it.
+  b = start - start % BPB;
+  for(n = 0; n <= d->sb.size / BPB + 1; n++){
+    bp = bread(dev, BBLOCK(b, d->sb));
+    w = (uint*)bp->data;
+    for(wi = (n == 0 ? start % BPB / 32 : 0); wi < BPB/32; wi++){
+      if(w[wi] == 0xffffffff)
+        continue;
+      bi = wi*32 + bsf(~w[wi]);
+      if(b + bi >= d->sb.size)
+        break;
+      w[wi] |= 1U << (bi % 32);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&fsalloc.lock);
+      if(goal == 0)
+        d->bhint = b + bi + BGAP;
+      d->nfree--;
+      release(&fsalloc.lock);
+      if(zero)
         bzero(dev, b + bi);
-        return b + bi;
-      }
+      return b + bi;
     }
     brelse(bp);
+    b += BPB;
+    if(b >= d->sb.size)
+      b = 0;
   }
   panic("balloc: out of blocks");
 }
@@ -82,10 +287,12 @@ balloc(uint dev)
 static void
 bfree(int dev, uint b)
 {
+  struct fsdev *d;
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  d = fsdev(dev);
+  bp = bread(dev, BBLOCK(b, d->sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -93,6 +300,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&fsalloc.lock);
+  d->nfree++;
+  release(&fsalloc.lock);
 }
 
 // Inodes.
@@ -103,7 +314,7 @@ bfree(int dev, uint b)
 // list of blocks holding the file's content.
 //
 // The inodes are laid out sequentially on disk at
-// sb.startinode. Each inode has a number, indicating its
+// sb.inodestart. Each inode has a number, indicating its
 // position on the disk.
 //
 // The kernel keeps a cache of in-use inodes in memory
@@ -120,18 +331,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a cache entry and
+//   increments its ref; iput() decrements ref. An entry whose
+//   ref is zero stays cached, and valid, until iget() needs
+//   it for another inode, so that reopening a recently used
+//   file does not read its inode from disk.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,36 +367,74 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cache is a hash table keyed by (dev, inum). Entries are
+// allocated a page at a time from free memory; once there are
+// NINODE of them, iget() instead recycles the least recently
+// used entry with no references, growing the cache only if
+// every entry is in use.
+//
+// The icache.lock reader-writer spin-lock protects the allocation
+// of icache entries. Since ip->dev and ip->inum indicate which
+// i-node an entry holds, and ip->ref whether it may be recycled,
+// one must hold icache.lock while using any of those fields.
+// Lookups and reference count changes only need it for reading,
+// with ip->ref updated atomically; recycling an entry needs it for
+// writing. icache.lrulock protects the LRU list, which holds
+// exactly the entries with ip->ref zero, so changes of ip->ref
+// to or from zero also hold it.
 //
-// An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// An ip->lock reader-writer sleep-lock protects all ip-> fields
+// other than ref, dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Path lookup only reads directories, so it takes directory locks
+// shared with ilockshared(); everything else uses ilock().
+
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
 
 struct {
-  struct spinlock lock;
-  struct inode inode[NINODE];
+  struct rwspinlock lock;
+  struct spinlock lrulock;
+  struct inode *hash[NIHASH];  // chains through hnext
+  int ninode;                  // entries allocated
+
+  // List of unreferenced entries, through lprev/lnext.
+  // lru.lnext is most recently used.
+  struct inode lru;
 } icache;
 
+// Set up the inode cache. Called from main(), since
+// userinit() looks up "/" before the first process
+// runs iinit().
+void
+icacheinit(void)
+{
+  initrwlock(&icache.lock, "icache");
+  initlock(&icache.lrulock, "icache.lru");
+  icache.lru.lprev = &icache.lru;
+  icache.lru.lnext = &icache.lru;
+}
+
 void
 iinit(int dev)
 {
-  log_info("dev:%d (must ==1 ROOTDEV)", dev);
-  int i = 0;
+  log_info("dev:%d (must == rootdev)", dev);
   
-  initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  struct superblock sb;
+
+  initlock(&fsalloc.lock, "fsalloc");
+  initsleeplock(&fsalloc.attachlock, "fsattach");
+  loginit();
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
+  if(sb.bsize != BSIZE)
+    panic("iinit: block size");
+  if(fsattach(dev, 0) < 0)
+    panic("iinit: bad root file system");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -196,18 +446,30 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, n;
+  struct fsdev *d;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  // Start from the lowest inum that may be free, and
+  // wrap around to inum 1.
+  d = fsdev(dev);
+  acquire(&fsalloc.lock);
+  inum = d->ihint;
+  release(&fsalloc.lock);
+  for(n = 1; n < d->sb.ninodes; n++, inum++){
+    if(inum >= d->sb.ninodes)
+      inum = 1;
+    bp = bread(dev, IBLOCK(inum, d->sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      acquire(&fsalloc.lock);
+      d->ihint = inum + 1;
+      release(&fsalloc.lock);
       return iget(dev, inum);
     }
     brelse(bp);
@@ -225,7 +487,7 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  bp = bread(ip->dev, IBLOCK(ip->inum, fsdev(ip->dev)->sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
@@ -237,6 +499,80 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Add ip to the LRU list, at the head if it is
+// worth keeping, else at the tail. Caller holds icache.lrulock.
+static void
+lruadd(struct inode *ip, int keep)
+{
+  struct inode *at;
+
+  at = keep ? &icache.lru : icache.lru.lprev;
+  ip->lnext = at->lnext;
+  ip->lprev = at;
+  at->lnext->lprev = ip;
+  at->lnext = ip;
+}
+
+// Remove ip from the LRU list. Caller holds icache.lrulock.
+static void
+lrudel(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext = ip->lprev = 0;
+}
+
+// Take a reference to cached inode ip.
+// Caller holds icache.lock, for reading or writing.
+static void
+iref(struct inode *ip)
+{
+  int r;
+
+  while((r = ip->ref) > 0)
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r+1))
+      return;
+  acquire(&icache.lrulock);
+  if(__sync_fetch_and_add(&ip->ref, 1) == 0)
+    lrudel(ip);
+  release(&icache.lrulock);
+}
+
+// Drop the last reference to ip, if it is the last,
+// putting it on the LRU list. Caller holds icache.lock.
+static void
+iunref(struct inode *ip)
+{
+  acquire(&icache.lrulock);
+  if(__sync_sub_and_fetch(&ip->ref, 1) == 0)
+    lruadd(ip, ip->valid);
+  release(&icache.lrulock);
+}
+
+// Give a page of memory to the cache, as unused
+// entries at the tail of the LRU list.
+// Caller holds icache.lock for writing.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *mem;
+  int i;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  acquire(&icache.lrulock);
+  for(i = 0; i < PGSIZE/sizeof(*ip); i++){
+    ip = (struct inode*)mem + i;
+    initrwsleeplock(&ip->lock, "inode");
+    lruadd(ip, 0);
+    icache.ninode++;
+  }
+  release(&icache.lrulock);
+  return 1;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
@@ -244,32 +580,54 @@ static struct inode*
 iget(uint dev, uint inum)
 {
   log_debug("dev:%u inum:%u", dev, inum);
-  struct inode *ip, *empty;
-
-  acquire(&icache.lock);
+  struct inode *ip, **pp;
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
+  // Other CPUs may be looking up inodes at the same time.
+  acquireread(&icache.lock);
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      iref(ip);
+      releaseread(&icache.lock);
+      return ip;
+    }
+  }
+  releaseread(&icache.lock);
+
+  // Not cached. Look again with the write lock held,
+  // since another CPU may have added it meanwhile.
+  acquirewrite(&icache.lock);
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      iref(ip);
+      releasewrite(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used cache entry,
+  // unless the cache may still grow.
+  if(icache.ninode < NINODE || icache.lru.lprev == &icache.lru)
+    igrow();
+  if(icache.lru.lprev == &icache.lru)
     panic("iget: no inodes");
+  acquire(&icache.lrulock);
+  ip = icache.lru.lprev;
+  lrudel(ip);
+  release(&icache.lrulock);
+  if(ip->inum != 0){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
+  releasewrite(&icache.lock);
 
   return ip;
 }
@@ -279,9 +637,9 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  acquireread(&icache.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&icache.lock);
   return ip;
 }
 
@@ -297,10 +655,10 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewritesleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread(ip->dev, IBLOCK(ip->inum, fsdev(ip->dev)->sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
     ip->major = dip->major;
@@ -309,20 +667,63 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->lastblk = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Lock the given inode for reading only, allowing
+// other readers at the same time.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquirereadsleep(&ip->lock);
+  if(ip->valid == 0){
+    // Loading the inode writes ip->xxx.
+    releasereadsleep(&ip->lock);
+    ilock(ip);
+    downgradesleep(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwritesleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewritesleep(&ip->lock);
+}
+
+// Unlock an inode locked with ilockshared().
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasereadsleep(&ip->lock);
+}
+
+// Inode inum on dev is free again; have ialloc()
+// start looking there.
+static void
+ifreed(uint dev, uint inum)
+{
+  struct fsdev *d;
+
+  d = fsdev(dev);
+  acquire(&fsalloc.lock);
+  if(inum < d->ihint)
+    d->ihint = inum;
+  release(&fsalloc.lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -335,24 +736,40 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquiresleep(&ip->lock);
+  int r;
+
+  // If this is not the last reference, the inode cannot
+  // be freed, so just drop the reference without taking
+  // ip->lock, which other processes may hold shared.
+  acquireread(&icache.lock);
+  while((r = ip->ref) > 1){
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r-1)){
+      releaseread(&icache.lock);
+      return;
+    }
+  }
+  releaseread(&icache.lock);
+
+  acquirewritesleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
-    acquire(&icache.lock);
-    int r = ip->ref;
-    release(&icache.lock);
+    acquireread(&icache.lock);
+    r = ip->ref;
+    releaseread(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
+      ifreed(ip->dev, ip->inum);
     }
   }
-  releasesleep(&ip->lock);
+  releasewritesleep(&ip->lock);
 
-  acquire(&icache.lock);
-  ip->ref--;
-  release(&icache.lock);
+  // Keep the entry cached, and valid, for the next iget().
+  acquireread(&icache.lock);
+  iunref(ip);
+  releaseread(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -369,38 +786,108 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// are reached through the double indirect block
+// ip->addrs[NDIRECT+1], which lists indirect blocks, and
+// the last NTINDIRECT through the triple indirect block
+// ip->addrs[NDIRECT+2].
+
+// Allocate a block for inode ip, after prev, the block
+// before it in the file, if that is known; else after
+// the last block allocated for ip.
+static uint
+iballoc(struct inode *ip, uint prev, int zero)
+{
+  if(prev == 0 && ip->lastblk != 0)
+    prev = ip->lastblk;
+  ip->lastblk = balloc(ip->dev, prev ? prev + 1 : 0, zero);
+  return ip->lastblk;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, zeroed
+// unless the caller is going to overwrite all of it.
+// Sets *fresh, if fresh is not 0, to whether it did.
 static uint
-bmap(struct inode *ip, uint bn)
+bmapz(struct inode *ip, uint bn, int zero, int *fresh)
 {
-  uint addr, *a;
+  uint addr, *a, span;
   struct buf *bp;
+  int level, i;
 
+  if(fresh)
+    *fresh = 0;
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      ip->addrs[bn] = addr = iballoc(ip, bn > 0 ? ip->addrs[bn-1] : 0, zero);
+      if(fresh)
+        *fresh = 1;
+    }
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the level of indirection, and span,
+  // the number of blocks below each entry at the top.
+  span = 1;
+  for(level = 1; level <= 3; level++){
+    if(bn < span*NINDIRECT)
+      break;
+    bn -= span*NINDIRECT;
+    span *= NINDIRECT;
+  }
+  if(level > 3)
+    panic("bmap: out of range");
+
+  // Walk down, loading indirect blocks and
+  // allocating them if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = iballoc(ip, 0, 1);
+  for(; level > 0; level--){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    i = bn / span;
+    if((addr = a[i]) == 0){
+      a[i] = addr = iballoc(ip, i > 0 ? a[i-1] : 0, level > 1 || zero);
       log_write(bp);
+      if(level == 1 && fresh)
+        *fresh = 1;
     }
     brelse(bp);
-    return addr;
+    bn %= span;
+    span /= NINDIRECT;
   }
+  return addr;
+}
+
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  return bmapz(ip, bn, 1, 0);
+}
+
+// Free indirect block addr and, below it,
+// level-1 more levels of indirect blocks
+// and the data blocks they list.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -411,9 +898,7 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -422,19 +907,15 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NADDRS; i++){
+    if(ip->addrs[i]){
+      ifree(ip->dev, ip->addrs[i], i - NDIRECT + 1);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
+  ip->lastblk = 0;
   iupdate(ip);
 }
 
@@ -479,14 +960,44 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Start reading blocks bn through bn+n-1 of ip into the
+// buffer cache, without waiting for them, so that a later
+// readi() finds them there. Stops at the end of the file.
+// Blocks that lie next to each other on disk are read
+// with one request. Caller must hold ip->lock.
+void
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint nb, addr, start, len;
+
+  if(ip->type == T_DEV)
+    return;
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  start = len = 0;
+  for(; n > 0 && bn < nb; n--, bn++){
+    addr = bmap(ip, bn);
+    if(len > 0 && addr == start + len){
+      len++;
+      continue;
+    }
+    if(len > 0)
+      breadahead(ip->dev, start, len);
+    start = addr;
+    len = 1;
+  }
+  if(len > 0)
+    breadahead(ip->dev, start, len);
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int fresh;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -496,12 +1007,18 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    // A new block that is about to be overwritten in full
+    // needs neither zeroing nor reading.
+    addr = bmapz(ip, off/BSIZE, m < BSIZE, &fresh);
+    if(fresh && m == BSIZE)
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -525,29 +1042,49 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Consults the dcache first; on a miss, scans the
+// directory a block at a time and caches the result,
+// even if the name is not there.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  struct buf *bp;
+  struct dirent *de, *end;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcacheget(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    bp = bread(dp->dev, bmap(dp, off/BSIZE));
+    de = (struct dirent*)bp->data;
+    end = de + (dp->size - off < BSIZE ? dp->size - off : BSIZE) / sizeof(*de);
+    for(; de < end; de++){
+      if(de->inum == 0)
+        continue;
+      if(namecmp(name, de->name) == 0){
+        // entry matches path element
+        inum = de->inum;
+        off += (uchar*)de - bp->data;
+        brelse(bp);
+        if(poff)
+          *poff = off;
+        dcacheenter(dp, name, inum, off);
+        return iget(dp->dev, inum);
+      }
     }
+    brelse(bp);
   }
 
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -577,6 +1114,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
@@ -633,33 +1171,97 @@ namex(char *path, int nameiparent, char *name)
 {
   log_debug("path:%s nameiparent:%d name:%s", path, nameiparent, name);
   struct inode *ip, *next;
+  struct fsdev *d;
+  uint dev, inum, seq, nextinum;
+  char *start, *p;
+  int neg;
+
+  if(*path == '/'){
+    dev = rootdev;
+    inum = ROOTINO;
+  } else {
+    dev = myproc()->cwd->dev;
+    inum = myproc()->cwd->inum;
+  }
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  // Follow cached directory entries as far as they go,
+  // without locking anything, then finish the walk below.
+  start = path;
+  seq = dcachebegin();
+  neg = 0;
+  rcureadlock();
+  while((p = skipelem(path, name)) != 0){
+    if(nameiparent && *p == '\0')
+      break;
+    if(dcachelookup(dev, inum, name, &nextinum) == 0)
+      break;
+    if(nextinum == 0){
+      neg = 1;
+      break;
+    }
+    // The cache knows nothing of mounts; leave
+    // steps into and out of file systems to below.
+    if(mountedon(dev, nextinum) ||
+       (inum == ROOTINO && dev != rootdev && namecmp(name, "..") == 0))
+      break;
+    inum = nextinum;
+    path = p;
+  }
+  rcureadunlock();
+  // A cached negative entry: the name does not exist.
+  if(neg && !dcacheretry(seq))
+    return 0;
+  ip = iget(dev, inum);
+  if(dcacheretry(seq)){
+    // An entry was removed during the walk, so ip may
+    // be stale. Walk the whole path the slow way.
+    iput(ip);
+    path = start;
+    if(*path == '/')
+      ip = iget(rootdev, ROOTINO);
+    else
+      ip = idup(myproc()->cwd);
+  }
 
   // TODO
   // exec("/init") -> namei("/init") -> namex("/init", 0, name)
   //   -> skipelem("/init", name)
   //                     ^ returns "", name = "init"
+  // Lookups only read directories, so lock them shared;
+  // lookups on other CPUs can then walk the same directories.
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // ".." of a mounted file system's root is the
+    // parent of the directory it is mounted on.
+    if(ip->inum == ROOTINO && ip->dev != rootdev && namecmp(name, "..") == 0){
+      next = idup(fsdev(ip->dev)->covered);
+      iput(ip);
+      ip = next;
+    }
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
     if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     ip = next;
+    // Step onto the root of a file system mounted here.
+    if((d = mountedon(ip->dev, ip->inum)) != 0){
+      next = iget(d->dev, ROOTINO);
+      iput(ip);
+      ip = next;
+    }
   }
   if(nameiparent){
     iput(ip);
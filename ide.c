@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code, for the disks on both channels
+// of the controller. Uses bus master DMA if the controller
+// can, else PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -12,35 +14,122 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bdev.h"
+#include "pci.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_IDE
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_IDENTIFY 0xec
+
+#define IDE_MAXSECT   256  // sectors per request
+#define IDE_MULT      16   // sectors per interrupt, if the disk allows
+#define IDE_MAXBLK    (IDE_MAXSECT*SECTOR_SIZE/BSIZE)  // bufs per request
+
+// Ticks a request may wait before it goes ahead of the
+// others; reads are more urgent, since someone waits for them.
+#define IDE_RDEADLINE 10
+#define IDE_WDEADLINE 50
+
+// Bus master registers, at offsets from a channel's bm.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4    // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08 // transfer from disk to memory
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_INTR 0x04
+
+// A physical region descriptor: one piece of
+// memory for a DMA transfer to fill or drain.
+struct prd {
+  uint addr;     // physical address
+  ushort n;      // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor in the table
+
+// The controller has two channels, each with up to two disks,
+// and each working on one request at a time. Disk unit u is
+// drive u%2 on channel u/2.
+//
+// A channel's cur points to the request now being read/written
+// to the disk. Other requests wait in readq or writeq, each sorted
+// by device and block number and linked through qnext.
+// A request is a buf, or a chain of bufs through mnext holding
+// consecutive blocks, which the disk transfers with one command.
+// You must hold the channel's lock while manipulating its queues.
+
+struct ideq {
+  struct buf *head;
+  struct buf *tail;
+  uint deadline;    // ticks
+};
+
+struct idechan {
+  struct spinlock lock;
+  int base;          // command block registers
+  int ctl;           // device control register
+  int irq;
+  uint bm;           // bus master registers, or 0 to use PIO
+  int pio;           // retrying the active request with PIO
+  int present[2];    // which disks are there
+  int mult[2];       // sectors per DRQ block, for each disk
+  struct buf *cur;
+  struct ideq readq;
+  struct ideq writeq;
+  uint posdev, posblk;  // where the last request ended
+
+  // Progress of the active request's PIO data transfer.
+  struct buf *xbuf;  // buf being transferred
+  int xoff;          // offset in xbuf->data
+  int xleft;         // sectors left
+
+  // One descriptor per buf of the active request, for DMA.
+  // The table must not cross a 64 KB boundary; aligning it
+  // to its size ensures that.
+  struct prd prdt[IDE_MAXBLK]
+    __attribute__((aligned(IDE_MAXBLK*sizeof(struct prd))));
+};
+
+static struct idechan idechan[2] = {
+  { .base = 0x1f0, .ctl = 0x3f6, .irq = IRQ_IDE },
+  { .base = 0x170, .ctl = 0x376, .irq = IRQ_IDE+1 },
+};
+
+static struct bdevops ideops = { iderwstart, iderwwait };
+
+static void idestart(struct idechan*, struct buf*);
+static struct buf *idenext(struct idechan*);
+
+// The channel of b's disk.
+static struct idechan*
+idechanof(struct buf *b)
+{
+  return &idechan[bdevget(b->dev)->unit / 2];
+}
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
-
-static struct spinlock idelock;
-static struct buf *idequeue;
-
-static int havedisk1;
-static void idestart(struct buf*);
-
-// Wait for IDE disk to become ready.
+// Wait for the selected disk on c to become ready.
 static int
-idewait(int checkerr)
+idewait(struct idechan *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     asm("nop");
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
@@ -48,111 +137,466 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask the selected disk on c who it is, and return its size
+// in sectors, or 0 if it does not answer like an ATA disk.
+// Runs with interrupts from c turned off.
+static uint
+ideidentify(struct idechan *c)
+{
+  ushort id[SECTOR_SIZE/2];
+  int i, r;
+
+  outb(c->base+7, IDE_CMD_IDENTIFY);
+  for(i = 0; i < 100000; i++)
+    if(((r = inb(c->base+7)) & IDE_BSY) == 0)
+      break;
+  if(r == 0 || (r & (IDE_BSY|IDE_ERR|IDE_DF)) || !(r & IDE_DRQ))
+    return 0;
+  insl(c->base, id, SECTOR_SIZE/4);
+  return id[60] | (id[61] << 16);  // sectors addressable with LBA28
+}
+
 void
 ideinit(void)
 {
-  int i;
+  struct idechan *c;
+  struct pcidev *p;
+  char name[4];
+  uint nsect;
+  int ch, i, n, r, unit;
+
+  // Use DMA if the IDE controller can be a bus master
+  // (bit 7 of its programming interface).
+  p = pcifind(PCI_CLASS_STORAGE, PCI_SUB_IDE);
+  if(p && (p->progif & 0x80))
+    pcienable(p);
+  else
+    p = 0;
+
+  for(ch = 0; ch < 2; ch++){
+    c = &idechan[ch];
+    initlock(&c->lock, "ide");
+    c->readq.deadline = IDE_RDEADLINE;
+    c->writeq.deadline = IDE_WDEADLINE;
+    if(p)
+      c->bm = (p->bar[4] & ~3) + 8*ch;
+
+    // Keep the disks from interrupting, since
+    // there is no request to finish.
+    outb(c->ctl, 2);
+    for(i = 0; i < 2; i++){
+      // Check if disk i is present; with no disk
+      // the status reads 0, or 0xff with no channel.
+      outb(c->base+6, 0xe0 | (i<<4));
+      for(n = 0; n < 1000; n++){
+        r = inb(c->base+7);
+        if(r != 0 && r != 0xff)
+          break;
+      }
+      if(n == 1000 || (nsect = ideidentify(c)) == 0)
+        continue;
+      c->present[i] = 1;
+
+      // Ask the disk to transfer IDE_MULT sectors per
+      // interrupt with READ/WRITE MULTIPLE, rather than one.
+      idewait(c, 0);
+      outb(c->base+2, IDE_MULT);
+      outb(c->base+7, IDE_CMD_SETMUL);
+      c->mult[i] = idewait(c, 1) < 0 ? 1 : IDE_MULT;
+
+      unit = ch*2 + i;
+      name[0] = 'h';
+      name[1] = 'd';
+      name[2] = 'a' + unit;
+      name[3] = 0;
+      bdevadd(name, &ideops, unit, nsect / (BSIZE/SECTOR_SIZE));
+    }
+    if(!c->present[0] && !c->present[1])
+      continue;
+
+    // Switch back to disk 0.
+    outb(c->base+6, 0xe0 | (0<<4));
+    // ncpu-1: the last cpu?
+    // 最終cpuに割り込ませる
+    ioapicenable(c->irq, ncpu - 1);
+    log_info("channel %d: %s", ch, c->bm ? "dma" : "pio");
+  }
+}
 
-  initlock(&idelock, "ide");
-  // ncpu-1: the last cpu?
-  // 最終cpuに割り込ませる
-  ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+// Point the controller at the bufs of request b,
+// and set the direction of the transfer.
+static void
+idedmasetup(struct idechan *c, struct buf *b)
+{
+  struct buf *m;
+  int n;
+
+  n = 0;
+  for(m = b; m; m = m->mnext){
+    c->prdt[n].addr = V2P(m->data);
+    c->prdt[n].n = BSIZE;
+    c->prdt[n].flags = m->mnext ? 0 : PRD_EOT;
+    n++;
+  }
+  outl(c->bm+BM_PRDT, V2P(c->prdt));
+  outb(c->bm+BM_STATUS, inb(c->bm+BM_STATUS) | BM_STATUS_ERR|BM_STATUS_INTR);  // clear
+  outb(c->bm+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+}
 
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
+// Transfer the next DRQ block of the active request,
+// to the disk if out is set, else from it.
+static void
+idepio(struct idechan *c, int out)
+{
+  int n;
+
+  n = c->mult[bdevget(c->cur->dev)->unit & 1];
+  for(; n > 0 && c->xleft > 0; n--, c->xleft--){
+    if(out)
+      outsl(c->base, c->xbuf->data + c->xoff, SECTOR_SIZE/4);
+    else
+      insl(c->base, c->xbuf->data + c->xoff, SECTOR_SIZE/4);
+    c->xoff += SECTOR_SIZE;
+    if(c->xoff == BSIZE){
+      c->xbuf = c->xbuf->mnext;
+      c->xoff = 0;
     }
   }
-
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b on c.  Caller must hold c->lock.
 static void
-idestart(struct buf *b)
+idestart(struct idechan *c, struct buf *b)
 {
   log_debug("b:%p", b);
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
+  struct bdev *d = bdevget(b->dev);
+  int drive = d->unit & 1;
   int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
-
-  if (sector_per_block > 7) panic("idestart");
-
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  int sector = (d->start + b->blockno) * sector_per_block;
+  int mult = c->mult[drive] > 1;
+  int read_cmd = mult ? IDE_CMD_RDMUL : IDE_CMD_READ;
+  int write_cmd = mult ? IDE_CMD_WRMUL : IDE_CMD_WRITE;
+  struct buf *m;
+  int nsect;
+
+  nsect = 0;
+  for(m = b; m; m = m->mnext)
+    nsect += sector_per_block;
+  if (nsect > IDE_MAXSECT) panic("idestart");
+
+  c->xbuf = b;
+  c->xoff = 0;
+  c->xleft = nsect;
+
+  outb(c->base+6, 0xe0 | (drive<<4));
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base+2, nsect & 0xff);  // number of sectors; 0 means 256
+  outb(c->base+3, sector & 0xff);
+  outb(c->base+4, (sector >> 8) & 0xff);
+  outb(c->base+5, (sector >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | (drive<<4) | ((sector>>24)&0x0f));
+  if(c->bm && !c->pio){
+    idedmasetup(c, b);
+    outb(c->base+7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(c->bm+BM_CMD, inb(c->bm+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    outb(c->base+7, write_cmd);
+    while((inb(c->base+7) & (IDE_BSY|IDE_DRQ|IDE_DF|IDE_ERR)) == IDE_BSY)
+      ;
+    idepio(c, 1);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(c->base+7, read_cmd);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel ch.
 void
-ideintr(void)
+ideintr(int ch)
 {
-  struct buf *b;
+  struct idechan *c;
+  struct buf *b, *m, *next;
+  int st;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  c = &idechan[ch];
+  acquire(&c->lock);
 
-  if((b = idequeue) == 0){
-    log_warn("idequeue == NULL");
-    release(&idelock);
+  // Bochs generates spurious interrupts.
+  if((b = c->cur) == 0){
+    log_debug("no active request");
+    release(&c->lock);
     return;
   }
 
-  log_debug("   b=idequeue:%p flags:%d dev:%u blockno:%u refcnt:%u prev:%p "
+  log_debug("   b=cur:%p flags:%d dev:%u blockno:%u refcnt:%u prev:%p "
             "next:%p qnext:%p data:%x%x%x",
             b, b->flags, b->dev, b->blockno, b->refcnt, b->prev, b->next,
             b->qnext, b->data[0], b->data[1], b->data[2]);
 
-  idequeue = b->qnext;
-
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
-
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
+  // With DMA the controller interrupts once, when the whole
+  // request is done. With PIO move the next DRQ block; the
+  // disk interrupts once per block until the request is done.
+  if(c->bm && !c->pio){
+    st = inb(c->bm+BM_STATUS);
+    if(!(st & BM_STATUS_INTR)){  // not the controller's
+      release(&c->lock);
+      return;
+    }
+    outb(c->bm+BM_CMD, 0);
+    outb(c->bm+BM_STATUS, inb(c->bm+BM_STATUS) | BM_STATUS_ERR|BM_STATUS_INTR);
+    if(idewait(c, 1) < 0 || (st & BM_STATUS_ERR)){
+      // Try the request once more without DMA.
+      log_warn("dma error, dev %d block %d", b->dev, b->blockno);
+      c->pio = 1;
+      idestart(c, b);
+      release(&c->lock);
+      return;
+    }
+  } else if(b->flags & B_DIRTY){
+    if(c->xleft > 0){
+      idepio(c, 1);
+      release(&c->lock);
+      return;
+    }
+    if(c->pio && idewait(c, 1) < 0)
+      panic("ideintr: write error");
+  } else if(idewait(c, 1) >= 0){
+    idepio(c, 0);
+    if(c->xleft > 0){
+      release(&c->lock);
+      return;
+    }
+  } else if(c->pio)
+    panic("ideintr: read error");
+  c->pio = 0;
 
   log_debug("           -> %p flags:%d dev:%u blockno:%u refcnt:%u prev:%p "
             "next:%p qnext:%p data:%x%x%x",
             b, b->flags, b->dev, b->blockno, b->refcnt, b->prev, b->next,
             b->qnext, b->data[0], b->data[1], b->data[2]);
 
-  wakeup(b);
+  // Finish each buf of the request; it may hold
+  // bufs of several callers, merged. biodone() may
+  // release a buf, so b must not be used after this.
+  for(m = b; m; m = next){
+    next = m->mnext;
+    biodone(m);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    log_warn("idestart(%p)", idequeue); // how reached?
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on the next request.
+  if((c->cur = idenext(c)) != 0)
+    idestart(c, c->cur);
 
-  release(&idelock);
+  release(&c->lock);
 }
 
 //PAGEBREAK!
+// Does a come before b in the order of the queues?
+static int
+before(struct buf *a, struct buf *b)
+{
+  return a->dev < b->dev || (a->dev == b->dev && a->blockno < b->blockno);
+}
+
+static struct buf*
+lastbuf(struct buf *b)
+{
+  while(b->mnext)
+    b = b->mnext;
+  return b;
+}
+
+static int
+nbufs(struct buf *b)
+{
+  int n;
+
+  for(n = 0; b; b = b->mnext)
+    n++;
+  return n;
+}
+
+// Can request b be extended by request c,
+// to be done with one command?
+static int
+adjacent(struct buf *b, struct buf *c)
+{
+  return b->dev == c->dev && lastbuf(b)->blockno + 1 == c->blockno &&
+    nbufs(b) + nbufs(c) <= IDE_MAXBLK;
+}
+
+// Add request b to q, in order, merging it with the
+// requests before and after it if their blocks adjoin.
+// Blocks usually come in ascending order, so try the
+// tail of the queue before searching it.
+static void
+ideqadd(struct ideq *q, struct buf *b)
+{
+  struct buf **pp, *prev, *n;
+
+  b->qtime = ticks;
+  if(q->tail && before(q->tail, b)){
+    prev = q->tail;
+    pp = &prev->qnext;
+  } else {
+    prev = 0;
+    for(pp = &q->head; *pp && before(*pp, b); pp = &(*pp)->qnext)
+      prev = *pp;
+  }
+
+  if(prev && adjacent(prev, b)){
+    lastbuf(prev)->mnext = b;
+    b = prev;
+  } else {
+    b->qnext = *pp;
+    *pp = b;
+  }
+  if((n = b->qnext) != 0 && adjacent(b, n)){
+    lastbuf(b)->mnext = n;
+    b->qnext = n->qnext;
+    if((int)(n->qtime - b->qtime) < 0)
+      b->qtime = n->qtime;
+  }
+  if(b->qnext == 0)
+    q->tail = b;
+}
+
+// Remove request b from q.
+static void
+ideqdel(struct ideq *q, struct buf *b)
+{
+  struct buf **pp, *prev;
+
+  prev = 0;
+  for(pp = &q->head; *pp != b; pp = &(*pp)->qnext)
+    prev = *pp;
+  *pp = b->qnext;
+  if(q->tail == b)
+    q->tail = prev;
+}
+
+// The request in q that has waited past its
+// deadline the longest, if any.
+static struct buf*
+ideqexpired(struct ideq *q)
+{
+  struct buf *b, *old;
+
+  old = 0;
+  for(b = q->head; b; b = b->qnext)
+    if(old == 0 || (int)(b->qtime - old->qtime) < 0)
+      old = b;
+  if(old && ticks - old->qtime > q->deadline)
+    return old;
+  return 0;
+}
+
+// The next request in q in C-LOOK order: the first at or
+// past the position of the last request, else the first.
+static struct buf*
+ideqnext(struct idechan *c, struct ideq *q)
+{
+  struct buf *b;
+
+  for(b = q->head; b; b = b->qnext)
+    if(b->dev > c->posdev || (b->dev == c->posdev && b->blockno >= c->posblk))
+      return b;
+  return q->head;
+}
+
+// Choose the next request and take it off its queue:
+// one that has waited too long, reads first; else the
+// next read in C-LOOK order; else the next write.
+static struct buf*
+idenext(struct idechan *c)
+{
+  struct ideq *q;
+  struct buf *b;
+
+  q = &c->readq;
+  if((b = ideqexpired(&c->readq)) == 0){
+    q = &c->writeq;
+    if((b = ideqexpired(&c->writeq)) == 0){
+      q = c->readq.head ? &c->readq : &c->writeq;
+      b = ideqnext(c, q);
+    }
+  }
+  if(b == 0)
+    return 0;
+  ideqdel(q, b);
+  b->qnext = 0;
+  c->posdev = b->dev;
+  c->posblk = lastbuf(b)->blockno + 1;
+  return b;
+}
+
+// Start a request for b, or for the chain of bufs
+// starting at b, and return without waiting for it.
+// If B_ASYNC is set, ideintr() will release the bufs with
+// biodone() when the request is done; otherwise the caller
+// must wait with iderwwait().
+void
+iderwstart(struct buf *b)
+{
+  log_debug("");
+  struct idechan *c;
+  struct bdev *d;
+  struct buf *m;
+  uint n;
+
+  d = bdevget(b->dev);
+  n = 0;
+  for(m = b; m; m = m->mnext){
+    if(!holdingsleep(&m->lock))
+      panic("iderw: buf not locked");
+    n++;
+  }
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(d->ops != &ideops)
+    panic("iderw: not an ide disk");
+  if(b->blockno >= d->size || n > d->size - b->blockno)
+    panic("iderw: block out of range");
+
+  c = &idechan[d->unit / 2];
+  acquire(&c->lock);  //DOC:acquire-lock
+
+  // From here on the request owns the buffer locks.
+  for(m = b; m; m = m->mnext)
+    if(m->flags & B_ASYNC)
+      disownsleep(&m->lock);
+
+  // Queue b, and start disk if it is idle.
+  ideqadd((b->flags & B_DIRTY) ? &c->writeq : &c->readq, b);  //DOC:insert-queue
+  if(c->cur == 0 && (c->cur = idenext(c)) != 0)
+    idestart(c, c->cur);
+
+  release(&c->lock);
+}
+
+// Wait for the request for b, started with iderwstart(), to finish.
+void
+iderwwait(struct buf *b)
+{
+  struct idechan *c;
+
+  c = idechanof(b);
+  acquire(&c->lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    log_debug("wait %p", b);
+    sleep(b, &c->lock);
+  }
+  release(&c->lock);
+}
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// b may head a chain of bufs with consecutive blocks through
+// mnext, all to be read or all to be written.
+// If B_ASYNC is set, return at once; ideintr() will
+// release buf with biodone() when the request is done.
 //
 // 1st call: alltraps() forkret() iinit(ROOTDEV) readsb(ROOTDEV, &sb)
 //   bread(ROOTDEV, 1) iderw(bget(ROOTDEV, 1))
@@ -161,43 +605,15 @@ ideintr(void)
 // b->blockno 1
 // b->qnext   NULL
 //
-// b->qnext = NULL;
-// idequeue = b;
-// idestart(b)
+// idechan[0].readq.head = b;
+// idechan[0].cur = idenext(&idechan[0]);  // b
+// idestart(&idechan[0], b)
 void
 iderw(struct buf *b)
 {
-  log_debug("");
-  struct buf **pp;
-
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
-
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    asm("nop");
-    ;
-  *pp = b;
-
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-  else
-    asm("nop");
-
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    log_debug("wait %p", b);
-    sleep(b, &idelock);
-  }
-
+  int async = b->flags & B_ASYNC;
 
-  release(&idelock);
+  iderwstart(b);
+  if(!async)
+    iderwwait(b);
 }
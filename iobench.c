@@ -0,0 +1,79 @@
+// Time sequential writes and reads of a large file,
+// to compare disks and drivers.
+//
+// usage: iobench [-r] [mb]
+//   -r  only read the file a previous run left behind
+//   mb  size of the file in megabytes (default 4)
+//
+// Reads of a file just written mostly hit the buffer
+// cache; to time the disk, reboot and run iobench -r.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define CHUNK (64*1024)
+
+char buf[CHUNK];
+char *file = "iobench.tmp";
+
+// Print n KB moved in t ticks (of 10 ms).
+void
+report(char *what, int n, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf(1, "%s %d KB in %d ticks, %d KB/s\n", what, n, t, n * 100 / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, mb, n, t, readonly;
+
+  mb = 4;
+  readonly = 0;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-r") == 0)
+      readonly = 1;
+    else if(argv[i][0] >= '0' && argv[i][0] <= '9')
+      mb = atoi(argv[i]);
+    else {
+      printf(2, "usage: iobench [-r] [mb]\n");
+      exit();
+    }
+  }
+  n = mb * 1024 * 1024 / CHUNK;
+  for(i = 0; i < CHUNK; i++)
+    buf[i] = i;
+
+  if(!readonly){
+    if((fd = open(file, O_CREATE|O_RDWR)) < 0){
+      printf(2, "iobench: cannot create %s\n", file);
+      exit();
+    }
+    t = uptime();
+    for(i = 0; i < n; i++)
+      if(write(fd, buf, CHUNK) != CHUNK){
+        printf(2, "iobench: write failed\n");
+        exit();
+      }
+    close(fd);
+    report("write", n * (CHUNK/1024), uptime() - t);
+  }
+
+  if((fd = open(file, O_RDONLY)) < 0){
+    printf(2, "iobench: cannot open %s\n", file);
+    exit();
+  }
+  t = uptime();
+  for(i = 0; i < n; i++)
+    if(read(fd, buf, CHUNK) != CHUNK){
+      printf(2, "iobench: read failed\n");
+      exit();
+    }
+  close(fd);
+  report("read", n * (CHUNK/1024), uptime() - t);
+  exit();
+}
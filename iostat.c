@@ -0,0 +1,29 @@
+// Print block I/O statistics.
+//
+// usage: iostat
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "iostat.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat st;
+
+  if(argc > 1){
+    printf(2, "usage: iostat\n");
+    exit();
+  }
+  if(iostat(&st) < 0){
+    printf(2, "iostat: iostat failed\n");
+    exit();
+  }
+
+  printf(1, "buffer cache: %d buffers\n", st.nbuf);
+  printf(1, "  bread %d hit %d\n", st.nbread, st.nbhit);
+  printf(1, "readahead: issued %d used %d wasted %d\n",
+         st.nraissued, st.nrahit, st.nrawasted);
+  exit();
+}
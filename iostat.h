@@ -0,0 +1,9 @@
+// Block I/O statistics, returned by the iostat system call.
+struct iostat {
+  uint nbuf;          // buffers in the cache
+  uint nbread;        // calls to bread
+  uint nbhit;         // ... that found the block cached
+  uint nraissued;     // blocks read ahead
+  uint nrahit;        // ... and later used
+  uint nrawasted;     // ... and evicted unused
+};
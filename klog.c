@@ -0,0 +1,215 @@
+// Kernel message log.
+//
+// log_debug(), log_info() and log_warn() append messages to a
+// ring buffer belonging to the CPU they run on, rather than
+// printing them. Only that CPU writes its ring, with interrupts
+// off, so appending takes no locks and never waits for the
+// console; logging from an interrupt handler does not hold up
+// other CPUs. The klogd kernel process copies new messages to
+// the console every tick, and the dmesg system call copies the
+// rings out to user space.
+//
+// Each message is one line: "[ticks] cpu message".
+//
+// A ring has two counters of bytes ever written: wbegin, moved
+// before the writer overwrites anything, and wend, moved once
+// the bytes are in place. A reader copies up to wend and then
+// discards whatever wbegin shows may have been overwritten
+// meanwhile.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+
+#define KLOGLINE 256   // longest message
+
+struct klogring {
+  char buf[KLOGSIZE];
+  volatile uint wbegin;
+  volatile uint wend;
+  uint dpos;  // bytes klogd has drained
+};
+
+static struct klogring rings[NCPU];
+
+// Format into buf, of size n, like cprintf().
+// Returns the length, not counting the terminating 0.
+static int
+kfmt(char *buf, int n, char *fmt, uint *argp)
+{
+  static char digits[] = "0123456789abcdef";
+  char tmp[16], *s;
+  int i, j, c, base, neg;
+  uint x;
+
+  j = 0;
+  for(i = 0; (c = fmt[i] & 0xff) != 0 && j < n-1; i++){
+    if(c != '%'){
+      buf[j++] = c;
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+    case 'u':
+    case 'x':
+    case 'p':
+      base = (c == 'd' || c == 'u') ? 10 : 16;
+      x = *argp++;
+      neg = c == 'd' && (int)x < 0;
+      if(neg)
+        x = -x;
+      s = tmp + sizeof(tmp);
+      *--s = 0;
+      do{
+        *--s = digits[x % base];
+      }while((x /= base) != 0);
+      if(neg)
+        *--s = '-';
+      break;
+    case 's':
+      if((s = (char*)*argp++) == 0)
+        s = "(null)";
+      break;
+    case 'c':
+      tmp[0] = *argp++;
+      tmp[1] = 0;
+      s = tmp;
+      break;
+    case '%':
+      s = "%";
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      tmp[0] = '%';
+      tmp[1] = c;
+      tmp[2] = 0;
+      s = tmp;
+      break;
+    }
+    for(; *s && j < n-1; s++)
+      buf[j++] = *s;
+  }
+  buf[j] = 0;
+  return j;
+}
+
+// Append a message to this CPU's ring.
+void
+klogf(char *fmt, ...)
+{
+  char line[KLOGLINE];
+  struct klogring *r;
+  uint args[2];
+  int n, m, i;
+
+  pushcli();
+  r = &rings[cpuid()];
+  args[0] = ticks;
+  args[1] = cpuid();
+  n = kfmt(line, sizeof(line), "[%d] %d", args);
+  n += kfmt(line+n, sizeof(line)-n, fmt, (uint*)(void*)(&fmt + 1));
+  if(n > 0 && line[n-1] != '\n')
+    line[n-1] = '\n';  // truncated
+
+  r->wbegin += n;
+  __sync_synchronize();
+  for(i = 0, m = r->wend; i < n; i++, m++)
+    r->buf[m & (KLOGSIZE-1)] = line[i];
+  __sync_synchronize();
+  r->wend = r->wbegin;
+  popcli();
+}
+
+// Copy the whole lines in r after position *pos, up to n-1
+// bytes, to dst, and 0-terminate them. Moves *pos past the
+// copied lines, or past lost ones. Returns the bytes copied.
+static int
+klogread(struct klogring *r, uint *pos, char *dst, int n)
+{
+  uint from, end, begin, i;
+  int m;
+
+  end = r->wend;
+  __sync_synchronize();
+  from = *pos;
+  if(end - from > KLOGSIZE)
+    from = end - KLOGSIZE;
+  if(end - from > n-1)
+    end = from + n-1;
+  for(i = from; i != end; i++)
+    dst[i - from] = r->buf[i & (KLOGSIZE-1)];
+  __sync_synchronize();
+  begin = r->wbegin;
+
+  // Drop bytes the writer may have overwritten,
+  // and any partial lines at either end.
+  m = 0;
+  if(begin - from > KLOGSIZE){
+    m = begin - KLOGSIZE - from;
+    if(m > end - from)
+      m = end - from;
+  }
+  if(from != *pos || m > 0)
+    while(m < end - from && dst[m++] != '\n')
+      ;
+  while(end != from + m && dst[end - from - 1] != '\n')
+    end--;
+  memmove(dst, dst + m, end - from - m);
+  dst[end - from - m] = 0;
+  *pos = end;
+  return end - from - m;
+}
+
+// Copy every CPU's messages not yet drained to the console.
+void
+klogflush(void)
+{
+  char buf[KLOGLINE];
+  struct klogring *r;
+
+  for(r = rings; r < &rings[NCPU]; r++)
+    while(r->dpos != r->wend && klogread(r, &r->dpos, buf, sizeof(buf)) > 0)
+      cprintf("%s", buf);
+}
+
+// Kernel process that drains the rings to the console.
+void
+klogd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    klogflush();
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks == ticks0)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+  }
+}
+
+// Copy the messages in every CPU's ring, up to n-1 bytes,
+// to dst, one CPU after another. Returns the bytes copied.
+int
+klogcopy(char *dst, int n)
+{
+  struct klogring *r;
+  uint pos;
+  int m;
+
+  m = 0;
+  for(r = rings; r < &rings[NCPU] && m < n-1; r++){
+    // Once the ring has wrapped, start before its oldest
+    // byte, so that klogread() drops the partial first line.
+    pos = r->wend > KLOGSIZE ? r->wend - KLOGSIZE - 1 : 0;
+    m += klogread(r, &pos, dst + m, n - m);
+  }
+  return m;
+}
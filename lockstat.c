@@ -0,0 +1,169 @@
+// Print the most contended kernel locks.
+//
+// usage: lockstat [-r] [-h] [n]
+//   -r  reset the statistics after printing them
+//   -h  also print wait and hold time histograms
+//   n   number of lock classes to print (default 10)
+//
+// Times are in TSC cycles. Call sites are kernel addresses;
+// look them up in kernel.asm.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+struct lockstat ls[NLOCKSTAT];
+
+// n / d without the compiler's 64-bit division helpers,
+// which user programs are not linked with.
+uint64
+div64(uint64 n, uint d)
+{
+  uint64 q, r;
+  int i;
+
+  if(d == 0)
+    return 0;
+  q = r = 0;
+  for(i = 63; i >= 0; i--){
+    r = (r << 1) | ((n >> i) & 1);
+    if(r >= d){
+      r -= d;
+      q |= (uint64)1 << i;
+    }
+  }
+  return q;
+}
+
+// Print x in decimal, right-aligned in a field of width w.
+void
+putu64(uint64 x, int w)
+{
+  char buf[24];
+  int i, n;
+
+  i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do{
+    n = x - div64(x, 10) * 10;
+    buf[--i] = '0' + n;
+    x = div64(x, 10);
+  }while(x != 0);
+  for(n = sizeof(buf) - 1 - i; n < w; n++)
+    printf(1, " ");
+  printf(1, "%s", buf + i);
+}
+
+// Print s left-aligned in a field of width w.
+void
+puts(char *s, int w)
+{
+  printf(1, "%s", s);
+  for(w -= strlen(s); w > 0; w--)
+    printf(1, " ");
+}
+
+void
+puthist(char *what, uint *h)
+{
+  int i;
+
+  printf(1, "    %s:", what);
+  for(i = 0; i < NLSHIST; i++)
+    if(h[i])
+      printf(1, " 2^%d:%d", i, h[i]);
+  printf(1, "\n");
+}
+
+char *types[] = {
+[LS_SPIN]    "spin",
+[LS_SLEEP]   "sleep",
+[LS_RWSPIN]  "rwspin",
+[LS_RWSLEEP] "rwslp",
+};
+
+void
+print(struct lockstat *l, int hist)
+{
+  int i;
+
+  puts(l->name, LSNAMESZ);
+  puts(types[l->type], 7);
+  putu64(l->nacquire, 10);
+  putu64(l->ncontended, 10);
+  putu64(l->waitcycles, 14);
+  putu64(div64(l->waitcycles, l->ncontended), 10);
+  putu64(div64(l->holdcycles, l->nacquire), 10);
+  printf(1, "\n");
+  for(i = 0; i < NLSSITE && i < 3; i++){
+    if(l->site[i].ncontended == 0)
+      break;
+    printf(1, "    at %x: %d contended, ", l->site[i].pc, l->site[i].ncontended);
+    putu64(l->site[i].waitcycles, 0);
+    printf(1, " cycles\n");
+  }
+  if(hist){
+    puthist("wait", l->waithist);
+    puthist("hold", l->holdhist);
+  }
+}
+
+// Sort locks by total wait time, most contended first.
+// Also sort each lock's call sites the same way.
+void
+sort(struct lockstat *l, int n)
+{
+  struct lockstat t;
+  struct lssite st;
+  int i, j, k;
+
+  for(i = 1; i < n; i++)
+    for(j = i; j > 0 && l[j].waitcycles > l[j-1].waitcycles; j--){
+      t = l[j];
+      l[j] = l[j-1];
+      l[j-1] = t;
+    }
+  for(k = 0; k < n; k++)
+    for(i = 1; i < NLSSITE; i++)
+      for(j = i; j > 0 &&
+          l[k].site[j].waitcycles > l[k].site[j-1].waitcycles; j--){
+        st = l[k].site[j];
+        l[k].site[j] = l[k].site[j-1];
+        l[k].site[j-1] = st;
+      }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, top, reset, hist;
+
+  reset = hist = 0;
+  top = 10;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-r") == 0)
+      reset = 1;
+    else if(strcmp(argv[i], "-h") == 0)
+      hist = 1;
+    else if(argv[i][0] >= '0' && argv[i][0] <= '9')
+      top = atoi(argv[i]);
+    else {
+      printf(2, "usage: lockstat [-r] [-h] [n]\n");
+      exit();
+    }
+  }
+
+  if((n = lockstat(reset ? LS_RESET : LS_GET, ls, NLOCKSTAT)) < 0){
+    printf(2, "lockstat: lockstat failed\n");
+    exit();
+  }
+  sort(ls, n);
+
+  puts("lock", LSNAMESZ);
+  puts("type", 7);
+  printf(1, "  acquires contended    wait-total  wait-avg  hold-avg\n");
+  for(i = 0; i < n && i < top; i++)
+    print(&ls[i], hist);
+  exit();
+}
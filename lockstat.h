@@ -0,0 +1,39 @@
+// Lock contention statistics.
+// Both the kernel and user programs use this header file.
+
+#define NLOCKSTAT    48  // maximum number of lock classes
+#define NLSHIST      32  // log2(cycles) buckets per histogram
+#define NLSSITE       8  // contended call sites kept per class
+#define LSNAMESZ     16
+
+// Lock types
+#define LS_SPIN   1  // spinlock
+#define LS_SLEEP  2  // sleeplock
+#define LS_RWSPIN 3  // reader-writer spinlock
+#define LS_RWSLEEP 4 // reader-writer sleeplock
+
+// lockstat() commands
+#define LS_GET    0  // copy out the statistics
+#define LS_RESET  1  // copy out, then clear the statistics
+
+// A place that had to wait to acquire a lock.
+struct lssite {
+  uint pc;            // return address of the acquire call
+  uint ncontended;    // contended acquisitions from pc
+  uint64 waitcycles;  // cycles spent waiting at pc
+};
+
+// Statistics for all locks that share a name.
+// Histogram bucket i counts events that lasted
+// [2^i, 2^(i+1)) TSC cycles.
+struct lockstat {
+  char name[LSNAMESZ];
+  int type;                 // LS_SPIN, LS_SLEEP, ...
+  uint nacquire;            // number of acquisitions
+  uint ncontended;          // acquisitions that found the lock held
+  uint64 waitcycles;        // total cycles spent waiting
+  uint64 holdcycles;        // total cycles the lock was held
+  uint waithist[NLSHIST];
+  uint holdhist[NLSHIST];
+  struct lssite site[NLSSITE];  // hottest contended call sites
+};
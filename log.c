@@ -3,8 +3,13 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bdev.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_LOG
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -15,203 +20,514 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// its start and end. Usually begin_op() just reserves
+// MAXOPBLOCKS log blocks for the call and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// A call that writes more blocks, up to logmaxop(), uses
+// begin_opn()/end_opn() to reserve that many instead.
+//
+// mkfs chooses the size of the log and records it in the
+// superblock; each half holds up to LOGSIZE blocks.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
+// It is double-buffered: it has two halves, each with the
+// on-disk format:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Commits alternate between the halves, and each header
+// carries a sequence number so that recovery can replay
+// them in order. Log appends are synchronous.
+//
+// Each file system in use has its own log, on its own disk,
+// recovered when it is attached. An FS system call takes part
+// in the transactions of all the logs, since it does not know
+// beforehand which file systems it will write; each log only
+// commits the blocks written to its own disk.
+//
+// FS system calls are kept out only while a commit copies
+// the transaction's blocks into the log's buffers, which
+// does not touch the disk. The next transaction then
+// accumulates while the commit writes the log.
+//
+// When the last outstanding operation ends, end_op() waits
+// up to GROUPCOMMIT ticks before committing if other
+// operations overlapped this transaction, so that more
+// operations can join it and share one commit.
+//
+// Installing a committed transaction's blocks to their home
+// locations is not synchronous either: the flusher kernel
+// process does it in the background, so the process that
+// commits waits only for the log writes. It installs from
+// the log's copies in the buffer cache, since the cached
+// home blocks may already hold updates from the next,
+// uncommitted transaction. Modified blocks stay pinned in
+// the cache until installed, and a commit waits until the
+// flusher has freed the half it is going to use.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint seq;
   int block[LOGSIZE];
 };
 
+// A committed transaction, and its cached home blocks.
+struct loghalf {
+  int installing;  // waiting for or being installed by the flusher.
+  struct logheader lh;
+  struct buf *pinned[LOGSIZE];
+};
+
 struct log {
+  int used;        // attached to a file system
+  int flushing;    // has a flusher process
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in each half
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // in end_op()'s commit loop.
+  int copying;     // in commit(), copying; begin_op() must wait.
+  int concurrent;  // did FS sys calls overlap in this transaction?
   int dev;
   struct logheader lh;
+  struct buf *pinned[LOGSIZE]; // cached blocks of lh
+  uint seq;        // sequence number for the next commit
+  int next;        // half for the next commit
+  struct loghalf half[2];
+  struct buf *to[LOGSIZE];   // commit()'s log buffers
+  struct buf ibuf[LOGSIZE];  // write log copies to home locations
+  struct buf *isort[LOGSIZE];  // ibuf sorted by home block number
+  struct buf *lbuf[LOGSIZE];   // log buffers being installed
 };
-struct log log;
 
-static void recover_from_log(void);
-static void commit();
+// The logs of the file systems in use; logs[0] is the root's.
+// Logs are only added, by initlog(), which holds logset
+// exclusively; FS system calls hold it shared, so the set
+// does not change under them.
+static struct log logs[NMOUNT];
+static struct rwsleeplock logset;
+
+static void recover_from_log(struct log*);
+static void commit(struct log*);
+static void flusher(void);
+
+// The header of log half h, and its i'th data block.
+#define LOGHEAD(h)     (log->start + (h)*(log->size+1))
+#define LOGBLOCK(h, i) (LOGHEAD(h) + 1 + (i))
 
 void
-initlog(int dev)
+loginit(void)
 {
-  log_info("dev:%d (must ==1 ROOTDEV)", dev);
+  initrwsleeplock(&logset, "logset");
+}
+
+// Start logging for the file system on dev, which has
+// superblock sb, after recovering its log. Returns -1 if
+// the log is too small or too big, or there are too many.
+int
+initlog(int dev, struct superblock *sb)
+{
+  log_info("dev:%d", dev);
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
-  struct superblock sb;
-  initlock(&log.lock, "log");
-  readsb(dev, &sb);
-  log.start = sb.logstart;
-  log.size = sb.nlog;
-  log.dev = dev;
-  log_debug("log. start:%d size:%d dev:%d", log.start, log.size, log.dev);
-  recover_from_log();
+  struct log *log;
+  int i, size;
+
+  // Every log must have room for the largest operation.
+  size = sb->nlog/2 - 1;
+  if (size < MAXOPBLOCKS || size > LOGSIZE ||
+      (logs[0].used && size < logmaxop()))
+    return -1;
+
+  acquirewritesleep(&logset);
+  for (log = logs; log < logs+NMOUNT && log->used; log++)
+    ;
+  if (log == logs+NMOUNT) {
+    releasewritesleep(&logset);
+    return -1;
+  }
+  initlock(&log->lock, "log");
+  log->start = sb->logstart;
+  log->size = size;
+  log->dev = dev;
+  for (i = 0; i < LOGSIZE; i++)
+    initsleeplock(&log->ibuf[i].lock, "log install");
+  log_debug("log. start:%d size:%d dev:%d", log->start, log->size, log->dev);
+  recover_from_log(log);
+  log->used = 1;
+  releasewritesleep(&logset);
+  kproc("flusher", flusher);
+  return 0;
+}
+
+// The log of the file system on dev.
+static struct log*
+logof(uint dev)
+{
+  struct log *log;
+
+  for (log = logs; log < logs+NMOUNT; log++)
+    if (log->used && log->dev == dev)
+      return log;
+  panic("logof");
 }
 
-// Copy committed blocks from log to their home location
+// Copy the committed blocks in log half h to their home
+// location, writing each log block's data straight to the
+// home block through log->ibuf, which is not in the buffer
+// cache. The writes are sorted by home block number, so that
+// adjacent blocks go to the disk as one request and the rest
+// in one sweep across it. If pinned is not 0, unpin the
+// cached home blocks.
 static void
-install_trans(void)
+install_trans(struct log *log, int h, struct logheader *lh, struct buf **pinned)
 {
-  if (log.lh.n > 0)
-    log_warn("log.dev:%d log.lh.n:%d", log.dev, log.lh.n);
+  if (lh->n > 0)
+    log_warn("log->dev:%d h:%d lh->n:%d", log->dev, h, lh->n);
 
-  int tail;
+  int tail, i;
+  struct buf **lbuf = log->lbuf;
+  struct buf **ib = log->isort, *t;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < lh->n; tail++)
+    lbuf[tail] = bread_async(log->dev, LOGBLOCK(h, tail)); // read log block
+  for (tail = 0; tail < lh->n; tail++) {
+    bwait(lbuf[tail]);
+    t = &log->ibuf[tail];
+    acquiresleep(&t->lock);
+    t->dev = log->dev;
+    t->blockno = lh->block[tail];
+    t->data = lbuf[tail]->data;
+    t->flags = B_VALID|B_DIRTY;
+    // insertion sort by home block number
+    for (i = tail; i > 0 && ib[i-1]->blockno > t->blockno; i--)
+      ib[i] = ib[i-1];
+    ib[i] = t;
+  }
+  bwritev(ib, lh->n);  // write dst to disk
+  for (tail = 0; tail < lh->n; tail++) {
+    releasesleep(&log->ibuf[tail].lock);
+    brelse(lbuf[tail]);
+    if(pinned)
+      bunpin(pinned[tail]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the header of log half h from disk
 static void
-read_head(void)
+read_head(struct log *log, int h, struct logheader *lh)
 {
   log_info("");
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct buf *buf = bread(log->dev, LOGHEAD(h));
+  struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lh->n = hb->n;
+  lh->seq = hb->seq;
+  // A mounted disk's log may hold anything.
+  if (lh->n < 0 || lh->n > log->size) {
+    log_warn("dev %d: bad log header, ignored", log->dev);
+    lh->n = 0;
+  }
+  for (i = 0; i < lh->n; i++) {
+    lh->block[i] = hb->block[i];
+    if (lh->block[i] < 0 || lh->block[i] >= bdevget(log->dev)->size) {
+      log_warn("dev %d: bad log header, ignored", log->dev);
+      lh->n = 0;
+    }
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write a log header to half h on disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(struct log *log, int h, struct logheader *lh)
 {
   log_info("");
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log->dev, LOGHEAD(h));
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  hb->seq = lh->seq;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
 static void
-recover_from_log(void)
+recover_from_log(struct log *log)
 {
   log_info("");
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logheader *lh0 = &log->half[0].lh;
+  struct logheader *lh1 = &log->half[1].lh;
+  int h;
+
+  read_head(log, 0, lh0);
+  read_head(log, 1, lh1);
+  // if committed, copy from log to disk, older half first
+  h = (lh0->n > 0 && lh1->n > 0 && lh1->seq < lh0->seq);
+  install_trans(log, h, &log->half[h].lh, 0);
+  install_trans(log, !h, &log->half[!h].lh, 0);
+  log->seq = (lh0->seq > lh1->seq ? lh0->seq : lh1->seq) + 1;
+  lh0->n = lh1->n = 0;
+  write_head(log, 0, lh0); // clear the log
+  write_head(log, 1, lh1);
+}
+
+// Kernel process that installs committed transactions
+// of one log, in the order they committed. It takes the
+// first log that has no flusher yet.
+static void
+flusher(void)
+{
+  struct logheader empty;
+  struct loghalf *hf;
+  struct log *log;
+  int h;
+
+  for (log = logs; log < logs+NMOUNT; log++) {
+    if (!log->used)
+      continue;
+    acquire(&log->lock);
+    if (!log->flushing)
+      break;
+    release(&log->lock);
+  }
+  if (log == logs+NMOUNT)
+    panic("flusher");
+  log->flushing = 1;
+
+  empty.n = 0;
+  empty.seq = 0;
+  for(;;){
+    h = log->half[0].installing ? 0 : 1;
+    if(log->half[0].installing && log->half[1].installing &&
+       log->half[1].lh.seq < log->half[0].lh.seq)
+      h = 1;
+    hf = &log->half[h];
+    if(!hf->installing){
+      sleep(&log->half, &log->lock);
+      continue;
+    }
+    release(&log->lock);
+
+    install_trans(log, h, &hf->lh, hf->pinned);
+    write_head(log, h, &empty);  // Erase the transaction from the log
+
+    acquire(&log->lock);
+    hf->installing = 0;
+    wakeup(&log->half);
+  }
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
-  acquire(&log.lock);
-  while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
-    } else {
-      log.outstanding += 1;
-      release(&log.lock);
-      break;
+  begin_opn(MAXOPBLOCKS);
+}
+
+// The most blocks one FS system call may reserve, leaving
+// room for others to run alongside it. initlog() does not
+// take logs smaller than this.
+int
+logmaxop(void)
+{
+  return logs[0].size/2 > MAXOPBLOCKS ? logs[0].size/2 : MAXOPBLOCKS;
+}
+
+// Start an FS system call that writes at most n blocks,
+// reserving n blocks in each log.
+void
+begin_opn(int n)
+{
+  struct log *log;
+
+  if(n > logmaxop())
+    panic("begin_opn");
+  acquirereadsleep(&logset);
+  for(log = logs; log < logs+NMOUNT && log->used; log++){
+    acquire(&log->lock);
+    while(1){
+      if(log->copying){
+        sleep(log, &log->lock);
+      } else if(log->lh.n + log->reserved + n > log->size){
+        // this op might exhaust log space; wait for commit.
+        sleep(log, &log->lock);
+      } else {
+        if(log->outstanding > 0)
+          log->concurrent = 1;
+        log->outstanding += 1;
+        log->reserved += n;
+        release(&log->lock);
+        break;
+      }
     }
   }
 }
 
+// Wait up to GROUPCOMMIT ticks for other FS system calls
+// to join the transaction, if any have overlapped it so far.
+static void
+groupwait(struct log *log)
+{
+  uint ticks0;
+
+  if(GROUPCOMMIT == 0 || !log->concurrent || log->lh.n == 0)
+    return;
+  acquire(&tickslock);
+  ticks0 = ticks;
+  while(ticks - ticks0 < GROUPCOMMIT)
+    sleep(&ticks, &tickslock);
+  release(&tickslock);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
-  acquire(&log.lock);
-  log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
-  release(&log.lock);
-
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+  end_opn(MAXOPBLOCKS);
+}
+
+// End an FS system call started with begin_opn(n).
+// In each log, commits if this was the last outstanding
+// operation and no other commit is in progress; otherwise
+// the operation will be committed with a later one.
+void
+end_opn(int n)
+{
+  struct log *log;
+  int do_commit;
+
+  for(log = logs; log < logs+NMOUNT && log->used; log++){
+    do_commit = 0;
+    acquire(&log->lock);
+    log->outstanding -= 1;
+    log->reserved -= n;
+    if(log->outstanding == 0 && !log->committing){
+      do_commit = 1;
+      log->committing = 1;
+    } else {
+      // begin_op() may be waiting for log space,
+      // and decrementing log->outstanding has decreased
+      // the amount of reserved space. commit() may be
+      // waiting for outstanding to reach zero.
+      wakeup(log);
+    }
+    release(&log->lock);
+
+    if(do_commit){
+      // call commit w/o holding locks, since not allowed
+      // to sleep with locks.
+      groupwait(log);
+      // Commit until nothing is left, since operations that
+      // ended during a commit did not commit themselves.
+      acquire(&log->lock);
+      while(log->lh.n > 0 && log->outstanding == 0){
+        release(&log->lock);
+        commit(log);
+        acquire(&log->lock);
+      }
+      if(log->lh.n == 0)  // nothing written to this log
+        log->concurrent = 0;
+      log->committing = 0;
+      wakeup(log);
+      release(&log->lock);
+    }
   }
+  releasereadsleep(&logset);
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the log buffers of half h.
+// Fills in to[] with the locked log buffers.
 static void
-write_log(void)
+copy_log(struct log *log, int h, struct logheader *lh, struct buf **to)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < lh->n; tail++) {
+    to[tail] = bget(log->dev, LOGBLOCK(h, tail)); // log block
+    struct buf *from = bread(log->dev, lh->block[tail]); // cache block
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the copied blocks to the log. They are
+// consecutive on disk, so this is a single request.
+static void
+write_log(struct logheader *lh, struct buf **to)
+{
+  int tail;
+
+  bwritev(to, lh->n);  // write the log
+  for (tail = 0; tail < lh->n; tail++)
+    brelse(to[tail]);
+}
+
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+commit(struct log *log)
+{
+  struct buf **to = log->to;
+  struct loghalf *hf;
+  int h;
+
+  // Keep new operations out until the transaction is copied.
+  acquire(&log->lock);
+  log->copying = 1;
+  while(log->outstanding > 0)
+    sleep(log, &log->lock);
+  h = log->next;
+  hf = &log->half[h];
+  // Wait for the flusher to finish with this half.
+  while(hf->installing)
+    sleep(&log->half, &log->lock);
+  hf->lh = log->lh;
+  hf->lh.seq = log->seq++;
+  memmove(hf->pinned, log->pinned, sizeof(log->pinned));
+  log->lh.n = 0;
+  log->concurrent = 0;
+  release(&log->lock);
+
+  if (hf->lh.n > 0) {
+    copy_log(log, h, &hf->lh, to);  // Copy modified blocks from cache to log buffers
+  }
+
+  // The next transaction may start.
+  acquire(&log->lock);
+  log->copying = 0;
+  wakeup(log);
+  release(&log->lock);
+
+  if (hf->lh.n > 0) {
+    write_log(&hf->lh, to);    // Write the log
+    write_head(log, h, &hf->lh);    // Write header to disk -- the real commit
+
+    // Hand the transaction to the flusher, which will
+    // install it to home locations and erase it.
+    acquire(&log->lock);
+    hf->installing = 1;
+    log->next = !h;
+    wakeup(&log->half);
+    release(&log->lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// Record the block number in the log of b's file system
+// and pin it in the cache.
+// commit()/write_log() will do the disk write, and
+// the flusher will install it and unpin it.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -221,22 +537,25 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct log *log;
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  log = logof(b->dev);
+  if (log->lh.n >= log->size)
     panic("too big a transaction");
-  if (log.outstanding < 1)
+  if (log->outstanding < 1)
     panic("log_write outside of trans");
 
-  acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  acquire(&log->lock);
+  for (i = 0; i < log->lh.n; i++) {
+    if (log->lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
-  release(&log.lock);
+  log->lh.block[i] = b->blockno;
+  if (i == log->lh.n){
+    log->pinned[i] = b;
+    bpin(b);  // prevent eviction
+    log->lh.n++;
+  }
+  release(&log->lock);
 }
-
@@ -0,0 +1,79 @@
+// Show or set kernel log levels.
+//
+// usage: loglevel [subsystem|all [level]]
+//   with no arguments, print every subsystem's level;
+//   level is debug, info, warn or none.
+//
+// Messages below the level the kernel was built with
+// (make LOGLEVEL=n) are compiled out and never print.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "loglevel.h"
+
+char *sysnames[] = {
+[LOGSYS_MAIN] "main",
+[LOGSYS_PROC] "proc",
+[LOGSYS_VM]   "vm",
+[LOGSYS_LOCK] "lock",
+[LOGSYS_BIO]  "bio",
+[LOGSYS_IDE]  "ide",
+[LOGSYS_FS]   "fs",
+[LOGSYS_LOG]  "log",
+[LOGSYS_DEV]  "dev",
+};
+
+char *levelnames[] = {
+[LOG_DEBUG] "debug",
+[LOG_INFO]  "info",
+[LOG_WARN]  "warn",
+[LOG_NONE]  "none",
+};
+
+int
+lookup(char **names, int n, char *s)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(strcmp(names[i], s) == 0)
+      return i;
+  return -2;
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: loglevel [subsystem|all [debug|info|warn|none]]\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, sys, level;
+
+  if(argc > 3)
+    usage();
+  if(argc == 1){
+    for(i = 0; i < NLOGSYS; i++)
+      printf(1, "%s %s\n", sysnames[i], levelnames[loglevel(i, -1)]);
+    printf(1, "(compiled in: %s and up)\n", levelnames[LOGLEVEL]);
+    exit();
+  }
+
+  if(strcmp(argv[1], "all") == 0)
+    sys = -1;
+  else if((sys = lookup(sysnames, NLOGSYS, argv[1])) < -1)
+    usage();
+  if(argc == 2){
+    printf(1, "%s\n", levelnames[loglevel(sys < 0 ? 0 : sys, -1)]);
+    exit();
+  }
+  if((level = lookup(levelnames, LOG_NONE+1, argv[2])) < 0)
+    usage();
+  if(loglevel(sys, level) < 0)
+    printf(2, "loglevel: loglevel failed\n");
+  exit();
+}
@@ -0,0 +1,26 @@
+// Kernel log levels and subsystems, for the log_* macros
+// in defs.h and the loglevel system call.
+
+#define LOG_DEBUG 0
+#define LOG_INFO  1
+#define LOG_WARN  2
+#define LOG_NONE  3  // print nothing
+
+// Least important level compiled into the kernel; messages
+// below it cost nothing. Set with make LOGLEVEL=n.
+#ifndef LOGLEVEL
+#define LOGLEVEL LOG_INFO
+#endif
+
+// Subsystems, each with its own runtime level.
+// A file that logs defines LOGSYS to one of these.
+#define LOGSYS_MAIN  0
+#define LOGSYS_PROC  1
+#define LOGSYS_VM    2
+#define LOGSYS_LOCK  3
+#define LOGSYS_BIO   4
+#define LOGSYS_IDE   5
+#define LOGSYS_FS    6
+#define LOGSYS_LOG   7
+#define LOGSYS_DEV   8  // buses and other device drivers
+#define NLOGSYS      9
@@ -5,6 +5,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_MAIN
 
 static void startothers(void);
 static void mpmain(void)  __attribute__((noreturn));
@@ -73,12 +76,19 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  dcacheinit();    // directory entry cache
+  icacheinit();    // inode cache
   fileinit();      // file table
+  pciinit();       // find PCI devices
   ideinit();       // disk 
+  virtioinit();    // virtio disk
+  bdevsetroot();   // choose the root disk
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit2();        // size buffer cache from free memory
   // TODO
   userinit();      // first user process
+  kproc("klogd", klogd); // drains kernel log to console
   mpmain();        // finish this processor's setup
 }
 
@@ -12,22 +12,26 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bdev.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_fsmem_img_start[], _binary_fsmem_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static struct bdevops memideops = { iderwstart, iderwwait };
 
+// The memory disk stands in for the root disk.
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_fsmem_img_start;
+  disksize = (uint)_binary_fsmem_img_size/BSIZE;
+  bdevadd(ROOTDEV, &memideops, 0, disksize);
 }
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int ch)
 {
   // no-op
 }
@@ -35,26 +39,45 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// b may head a chain of bufs with consecutive blocks through mnext.
+// If B_ASYNC is set, release buf with biodone() when done.
 void
 iderw(struct buf *b)
 {
+  struct buf *m, *next;
   uchar *p;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 1)
-    panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
-    panic("iderw: block out of range");
-
-  p = memdisk + b->blockno*BSIZE;
-
-  if(b->flags & B_DIRTY){
-    b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
-  } else
-    memmove(b->data, p, BSIZE);
-  b->flags |= B_VALID;
+  for(m = b; m; m = next){
+    next = m->mnext;
+    if(!holdingsleep(&m->lock))
+      panic("iderw: buf not locked");
+    if((m->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(bdevget(m->dev)->ops != &memideops)
+      panic("iderw: request not for memory disk");
+    if(m->blockno >= disksize)
+      panic("iderw: block out of range");
+
+    p = memdisk + m->blockno*BSIZE;
+
+    if(m->flags & B_DIRTY)
+      memmove(p, m->data, BSIZE);
+    else
+      memmove(m->data, p, BSIZE);
+    if(m->flags & B_ASYNC)
+      disownsleep(&m->lock);
+    biodone(m);
+  }
+}
+
+// The memory disk finishes requests at once.
+void
+iderwstart(struct buf *b)
+{
+  iderw(b);
+}
+
+void
+iderwwait(struct buf *b)
+{
 }
@@ -0,0 +1,22 @@
+// Mount a file system on a directory.
+//
+// usage: mount dev dir
+//   dev  block device name, such as hdc or hdb1
+//
+// There is no umount; a mount lasts until reboot.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 3){
+    printf(2, "usage: mount dev dir\n");
+    exit();
+  }
+  if(mount(argv[1], argv[2]) < 0)
+    printf(2, "mount: cannot mount %s on %s\n", argv[1], argv[2]);
+  exit();
+}
@@ -3,12 +3,23 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       200  // i-nodes cached before reusing unreferenced ones
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define ROOTDEV   "hdb"  // root disk, unless there is a virtio disk
+#define NBDEV        16  // block devices: disks and partitions
+#define NMOUNT        4  // mounted file systems, the root included
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      120  // max data blocks in a log transaction
+#define LOGBLOCKS    (MAXOPBLOCKS*6)  // data blocks in each log half mkfs makes
+#define GROUPCOMMIT  1  // ticks a commit waits for more FS ops to join
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define NBUFMAX      4096  // maximum size of disk block cache
+#define BCACHEFRAC   8  // binit2() gives the cache 1/BCACHEFRAC of free memory
+#define NREADAHEAD   32  // maximum blocks of sequential readahead
+#define FSSIZE       4000  // size of file system in blocks
+#define NDENTRY      256  // size of directory entry cache
+#define KLOGSIZE     4096  // bytes of kernel log per CPU; a power of 2
+#define PIPEPG       4  // pages in a new pipe's buffer; a power of 2
+#define PIPEMAXPG    16  // max pages in a pipe buffer; a power of 2
 
@@ -0,0 +1,148 @@
+// PCI bus enumeration, and configuration space access
+// through configuration mechanism #1 (I/O ports 0xcf8 and 0xcfc).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "pci.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_DEV
+
+#define CONFADDR 0xcf8
+#define CONFDATA 0xcfc
+
+static struct pcidev pcidevs[NPCIDEV];
+static int npcidev;
+
+// Read the 32-bit configuration register off of function tag.
+uint
+pciread(uint tag, uint off)
+{
+  outl(CONFADDR, 0x80000000 | tag | (off & 0xfc));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(uint tag, uint off, uint v)
+{
+  outl(CONFADDR, 0x80000000 | tag | (off & 0xfc));
+  outl(CONFDATA, v);
+}
+
+// Record the function at tag.
+static void
+pciadd(uint tag)
+{
+  struct pcidev *p;
+  uint id, c;
+  int i;
+
+  if(npcidev == NPCIDEV){
+    log_warn("too many devices");
+    return;
+  }
+  p = &pcidevs[npcidev++];
+  p->tag = tag;
+  id = pciread(tag, PCI_ID);
+  p->vendor = id & 0xffff;
+  p->device = id >> 16;
+  c = pciread(tag, PCI_CLASS);
+  p->class = c >> 24;
+  p->subclass = c >> 16;
+  p->progif = c >> 8;
+  p->irq = pciread(tag, PCI_INTR);
+  for(i = 0; i < 6; i++)
+    p->bar[i] = pciread(tag, PCI_BAR(i));
+  log_info("%x:%x.%x %x:%x class %x.%x irq %d", tag>>16, (tag>>11)&0x1f,
+           (tag>>8)&7, p->vendor, p->device, p->class, p->subclass, p->irq);
+}
+
+// Find every function on every bus.
+void
+pciinit(void)
+{
+  uint bus, dev, func, nfunc, tag;
+
+  for(bus = 0; bus < 256; bus++)
+    for(dev = 0; dev < 32; dev++){
+      nfunc = 1;
+      for(func = 0; func < nfunc; func++){
+        tag = PCITAG(bus, dev, func);
+        if((pciread(tag, PCI_ID) & 0xffff) == 0xffff)
+          continue;
+        if(func == 0 && (pciread(tag, PCI_HDRTYPE) & 0x800000))
+          nfunc = 8;  // multi-function device
+        pciadd(tag);
+      }
+    }
+}
+
+// Return the first function with the given
+// class and subclass, or 0 if there is none.
+struct pcidev*
+pcifind(uint class, uint subclass)
+{
+  struct pcidev *p;
+
+  for(p = pcidevs; p < &pcidevs[npcidev]; p++)
+    if(p->class == class && p->subclass == subclass)
+      return p;
+  return 0;
+}
+
+// Return the first function with the given
+// vendor and device ids, or 0 if there is none.
+struct pcidev*
+pcilookup(uint vendor, uint device)
+{
+  struct pcidev *p;
+
+  for(p = pcidevs; p < &pcidevs[npcidev]; p++)
+    if(p->vendor == vendor && p->device == device)
+      return p;
+  return 0;
+}
+
+// Let p respond to I/O and memory accesses and do DMA.
+void
+pcienable(struct pcidev *p)
+{
+  pciwrite(p->tag, PCI_CMD, (pciread(p->tag, PCI_CMD) & 0xffff) |
+           PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
+
+// Call intr for p's interrupts, on the last CPU.
+// Returns -1 if p has no interrupt line.
+int
+pcisetintr(struct pcidev *p, void (*intr)(void))
+{
+  if(p->irq == 0xff){
+    log_warn("%x:%x has no interrupt line", p->vendor, p->device);
+    return -1;
+  }
+  p->intr = intr;
+  ioapicenable(p->irq, ncpu - 1);
+  return 0;
+}
+
+// Called by trap() for an interrupt that no other driver
+// claims. Functions may share an interrupt line, so call
+// the handler of each one on irq. Returns 0 if there is none.
+int
+pciintr(int irq)
+{
+  struct pcidev *p;
+  int n;
+
+  n = 0;
+  for(p = pcidevs; p < &pcidevs[npcidev]; p++)
+    if(p->irq == irq && p->intr){
+      p->intr();
+      n++;
+    }
+  return n;
+}
@@ -0,0 +1,36 @@
+// PCI configuration space.
+
+// A function is named by a tag, its bus, device and
+// function numbers packed as in the CONFIG_ADDRESS register.
+#define PCITAG(bus, dev, func) (((bus)<<16) | ((dev)<<11) | ((func)<<8))
+
+// Configuration space registers.
+#define PCI_ID        0x00  // device id << 16 | vendor id
+#define PCI_CMD       0x04  // command (low 16 bits), status
+#define PCI_CLASS     0x08  // class << 24 | subclass << 16 | prog if << 8
+#define PCI_HDRTYPE   0x0c  // header type in bits 16-23
+#define PCI_BAR(i)    (0x10 + 4*(i))
+#define PCI_INTR      0x3c  // interrupt line in bits 0-7
+
+// Command register bits.
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // may act as bus master (DMA)
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUB_IDE       0x01
+
+#define NPCIDEV 32  // functions pciinit() records
+
+// A function found on the bus.
+struct pcidev {
+  uint tag;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;           // interrupt line, as the BIOS set it up
+  uint bar[6];         // base address registers
+  void (*intr)(void);  // interrupt handler, see pcisetintr()
+};
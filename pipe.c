@@ -6,19 +6,49 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The buffer is a ring of whole pages. Byte i of the stream
+// lives at offset i % size, so each copy in or out moves the
+// contiguous span up to the end of a page with one memmove.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *pg[PIPEMAXPG];  // buffer pages
+  uint size;      // buffer size: PGSIZE times a power of 2
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+// Allocate npg buffer pages into pg.
+static int
+pgalloc(char **pg, int npg)
+{
+  int i;
+
+  for(i = 0; i < npg; i++){
+    if((pg[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(pg[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+pgfree(char **pg, int npg)
+{
+  int i;
+
+  for(i = 0; i < npg; i++)
+    kfree(pg[i]);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +60,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if(pgalloc(p->pg, PIPEPG) < 0){
+    kfree((char*)p);
+    p = 0;
+    goto bad;
+  }
+  p->size = PIPEPG*PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -69,6 +105,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    pgfree(p->pg, p->size/PGSIZE);
     kfree((char*)p);
   } else
     release(&p->lock);
@@ -79,10 +116,11 @@ int
 pipewrite(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint off, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
@@ -90,7 +128,11 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    off = p->nwrite % p->size;
+    m = min(n - i, p->nread + p->size - p->nwrite);
+    m = min(m, PGSIZE - off%PGSIZE);
+    memmove(p->pg[off/PGSIZE] + off%PGSIZE, addr + i, m);
+    p->nwrite += m;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
@@ -101,6 +143,7 @@ int
 piperead(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint off, m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +153,66 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    off = p->nread % p->size;
+    m = min(n - i, p->nwrite - p->nread);
+    m = min(m, PGSIZE - off%PGSIZE);
+    memmove(addr + i, p->pg[off/PGSIZE] + off%PGSIZE, m);
+    p->nread += m;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+// The size of p's buffer in bytes.
+int
+pipesize(struct pipe *p)
+{
+  return p->size;
+}
+
+// Resize p's buffer to hold at least n bytes, rounded up
+// to a power-of-2 number of pages. Fails if that is more
+// than PIPEMAXPG pages or less than the data now buffered.
+// Returns the new size.
+int
+pipesetsize(struct pipe *p, int n)
+{
+  char *pg[PIPEMAXPG], *old[PIPEMAXPG];
+  int npg, onpg;
+  uint i, cnt, off, m;
+
+  if(n <= 0 || n > PIPEMAXPG*PGSIZE)
+    return -1;
+  for(npg = 1; npg*PGSIZE < n; npg *= 2)
+    ;
+  if(pgalloc(pg, npg) < 0)
+    return -1;
+
+  acquire(&p->lock);
+  cnt = p->nwrite - p->nread;
+  if(cnt > npg*PGSIZE){
+    release(&p->lock);
+    pgfree(pg, npg);
+    return -1;
+  }
+  // Move the buffered bytes to the start of the new pages.
+  for(i = 0; i < cnt; i += m){
+    off = (p->nread + i) % p->size;
+    m = min(cnt - i, PGSIZE - off%PGSIZE);
+    m = min(m, PGSIZE - i%PGSIZE);
+    memmove(pg[i/PGSIZE] + i%PGSIZE, p->pg[off/PGSIZE] + off%PGSIZE, m);
+  }
+  onpg = p->size/PGSIZE;
+  memmove(old, p->pg, sizeof(old));
+  memmove(p->pg, pg, sizeof(pg));
+  p->size = npg*PGSIZE;
+  p->nread = 0;
+  p->nwrite = cnt;
+  wakeup(&p->nwrite);
+  release(&p->lock);
+
+  pgfree(old, onpg);
+  return npg*PGSIZE;
+}
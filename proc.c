@@ -6,6 +6,9 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_PROC
 
 struct {
   struct spinlock lock;
@@ -179,6 +182,27 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Set up a kernel process that runs fn() and never
+// enters user space. fn must not return.
+struct proc*
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc: no procs");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kproc: out of memory?");
+  // Have forkret() return to fn rather than trapret.
+  *(uint*)((char*)p->context + sizeof(*p->context)) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -361,6 +385,7 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
+    rcuquiescent();
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
@@ -410,6 +435,7 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
+  rcuquiescent();
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -439,8 +465,8 @@ forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
-    initlog(ROOTDEV);
+    bdevparts();
+    iinit(rootdev);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  uint rcuqs;                  // Quiescent states passed, for RCU
 };
 
 extern struct cpu cpus[NCPU];
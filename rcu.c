@@ -0,0 +1,66 @@
+// Read-copy-update.
+//
+// Readers bracket their accesses with rcureadlock() and
+// rcureadunlock() and take no locks. A read-side section
+// runs with interrupts off, so it cannot sleep or be
+// preempted, and it is over by the next time its CPU passes
+// through the scheduler.
+//
+// Each CPU counts those passes in rcuqs (quiescent states).
+// A writer that has unlinked an object from a structure that
+// readers walk calls rcusync() before reusing the object;
+// rcusync() waits until every other CPU has passed through
+// the scheduler, after which no reader can still see the object.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+
+void
+rcureadlock(void)
+{
+  pushcli();
+}
+
+void
+rcureadunlock(void)
+{
+  popcli();
+}
+
+// Record a quiescent state for this CPU.
+// Called with interrupts off from sched() and scheduler().
+void
+rcuquiescent(void)
+{
+  mycpu()->rcuqs++;
+}
+
+// Wait until all read-side sections that might have
+// started before the call have finished.
+// Must not be called with locks held, since it may yield.
+void
+rcusync(void)
+{
+  uint snap[NCPU];
+  int i, me;
+
+  pushcli();
+  me = cpuid();
+  for(i = 0; i < ncpu; i++)
+    snap[i] = cpus[i].rcuqs;
+  popcli();
+
+  // This CPU is not in a read-side section,
+  // so it needs no quiescent state.
+  for(i = 0; i < ncpu; i++){
+    if(i == me)
+      continue;
+    while(*(volatile uint*)&cpus[i].rcuqs == snap[i])
+      yield();
+  }
+}
@@ -0,0 +1,269 @@
+// Reader-writer locks.
+//
+// Both kinds prefer writers: once a writer is waiting,
+// new readers wait too, so a steady stream of readers
+// cannot starve it. A consequence is that a reader must
+// not acquire a read lock it already holds.
+//
+// Like sleep locks, the sleeping kind spins instead of
+// sleeping while a writer holds it and is running on
+// another CPU.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "lockstat.h"
+
+void
+initrwlock(struct rwspinlock *rw, char *name)
+{
+  rw->name = name;
+  rw->writer = 0;
+  rw->readers = 0;
+  rw->cpu = 0;
+  rw->class = lsregister(name, LS_RWSPIN);
+}
+
+// Acquire rw for reading. Like acquire(), spins
+// with interrupts off until no writer holds or
+// waits for the lock.
+void
+acquireread(struct rwspinlock *rw)
+{
+  int contended;
+  uint64 t0;
+
+  pushcli();
+  if(holdingwrite(rw))
+    panic("acquireread");
+
+  contended = 0;
+  t0 = 0;
+  for(;;){
+    if(rw->writer){
+      if(!contended){
+        contended = 1;
+        t0 = rdtsc();
+      }
+      while(*(volatile uint*)&rw->writer)
+        pause();
+    }
+    // The locked add is a full barrier, so the
+    // writer check below cannot move above it.
+    __sync_fetch_and_add(&rw->readers, 1);
+    if(rw->writer == 0)
+      break;
+    // A writer got in first; back off.
+    __sync_fetch_and_sub(&rw->readers, 1);
+  }
+
+  lsacquire(rw->class, contended, contended ? rdtsc() - t0 : 0,
+            (uint)__builtin_return_address(0));
+}
+
+void
+releaseread(struct rwspinlock *rw)
+{
+  if(rw->readers <= 0)
+    panic("releaseread");
+  __sync_fetch_and_sub(&rw->readers, 1);
+  popcli();
+}
+
+// Acquire rw for writing: claim the writer flag,
+// which keeps new readers out, then wait for the
+// current readers to drain.
+void
+acquirewrite(struct rwspinlock *rw)
+{
+  int contended;
+  uint64 t0;
+
+  pushcli();
+  if(holdingwrite(rw))
+    panic("acquirewrite");
+
+  contended = 0;
+  t0 = 0;
+  if(xchg(&rw->writer, 1) != 0){
+    contended = 1;
+    t0 = rdtsc();
+    while(xchg(&rw->writer, 1) != 0)
+      ;
+  }
+  if(rw->readers){
+    if(!contended){
+      contended = 1;
+      t0 = rdtsc();
+    }
+    while(*(volatile int*)&rw->readers)
+      pause();
+  }
+  __sync_synchronize();
+
+  rw->cpu = mycpu();
+  rw->tacquire = rdtsc();
+  lsacquire(rw->class, contended, contended ? rw->tacquire - t0 : 0,
+            (uint)__builtin_return_address(0));
+}
+
+void
+releasewrite(struct rwspinlock *rw)
+{
+  if(!holdingwrite(rw))
+    panic("releasewrite");
+
+  lsrelease(rw->class, rdtsc() - rw->tacquire);
+  rw->cpu = 0;
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (rw->writer) : );
+  popcli();
+}
+
+// Check whether this cpu is holding rw for writing.
+int
+holdingwrite(struct rwspinlock *rw)
+{
+  int r;
+
+  pushcli();
+  r = rw->writer && rw->cpu == mycpu();
+  popcli();
+  return r;
+}
+
+//PAGEBREAK!
+// Reader-writer sleep locks.
+
+void
+initrwsleeplock(struct rwsleeplock *rw, char *name)
+{
+  initlock(&rw->lk, "rw sleep lock");
+  rw->name = name;
+  rw->readers = 0;
+  rw->writer = 0;
+  rw->wwaiting = 0;
+  rw->pid = 0;
+  rw->owner = 0;
+  rw->nsleepers = 0;
+  rw->class = lsregister(name, LS_RWSLEEP);
+}
+
+// Wait for rw to change state. Spin if a running writer
+// holds it, otherwise sleep. Called and returns with rw->lk held.
+static void
+rwsleepwait(struct rwsleeplock *rw)
+{
+  struct proc *owner;
+
+  if(ownerrunning(owner = rw->owner)){
+    release(&rw->lk);
+    while(*(volatile int*)&rw->writer &&
+          *(struct proc* volatile*)&rw->owner == owner &&
+          ownerrunning(owner))
+      pause();
+    acquire(&rw->lk);
+    return;
+  }
+  rw->nsleepers++;
+  sleep(rw, &rw->lk);
+  rw->nsleepers--;
+}
+
+void
+acquirereadsleep(struct rwsleeplock *rw)
+{
+  int contended;
+  uint64 t0;
+
+  acquire(&rw->lk);
+  t0 = rdtsc();
+  contended = rw->writer || rw->wwaiting;
+  while(rw->writer || rw->wwaiting)
+    rwsleepwait(rw);
+  rw->readers++;
+  lsacquire(rw->class, contended, contended ? rdtsc() - t0 : 0,
+            (uint)__builtin_return_address(0));
+  release(&rw->lk);
+}
+
+void
+releasereadsleep(struct rwsleeplock *rw)
+{
+  acquire(&rw->lk);
+  if(rw->readers <= 0)
+    panic("releasereadsleep");
+  if(--rw->readers == 0 && rw->wwaiting && rw->nsleepers)
+    wakeup(rw);
+  release(&rw->lk);
+}
+
+void
+acquirewritesleep(struct rwsleeplock *rw)
+{
+  int contended;
+  uint64 t0;
+
+  acquire(&rw->lk);
+  t0 = rdtsc();
+  contended = rw->writer || rw->readers;
+  rw->wwaiting++;
+  while(rw->writer || rw->readers)
+    rwsleepwait(rw);
+  rw->wwaiting--;
+  rw->writer = 1;
+  rw->pid = myproc()->pid;
+  rw->owner = myproc();
+  rw->tacquire = rdtsc();
+  lsacquire(rw->class, contended, contended ? rw->tacquire - t0 : 0,
+            (uint)__builtin_return_address(0));
+  release(&rw->lk);
+}
+
+void
+releasewritesleep(struct rwsleeplock *rw)
+{
+  acquire(&rw->lk);
+  lsrelease(rw->class, rdtsc() - rw->tacquire);
+  rw->writer = 0;
+  rw->pid = 0;
+  rw->owner = 0;
+  if(rw->nsleepers)
+    wakeup(rw);
+  release(&rw->lk);
+}
+
+// Turn a write lock into a read lock without letting
+// another writer in between.
+void
+downgradesleep(struct rwsleeplock *rw)
+{
+  acquire(&rw->lk);
+  if(!rw->writer || rw->pid != myproc()->pid)
+    panic("downgradesleep");
+  lsrelease(rw->class, rdtsc() - rw->tacquire);
+  rw->writer = 0;
+  rw->pid = 0;
+  rw->owner = 0;
+  rw->readers++;
+  if(rw->nsleepers)
+    wakeup(rw);
+  release(&rw->lk);
+}
+
+int
+holdingwritesleep(struct rwsleeplock *rw)
+{
+  int r;
+
+  acquire(&rw->lk);
+  r = rw->writer && (rw->pid == myproc()->pid);
+  release(&rw->lk);
+  return r;
+}
@@ -0,0 +1,35 @@
+// Reader-writer spin lock for read-mostly kernel data.
+// Any number of readers, or one writer.
+struct rwspinlock {
+  uint writer;       // Is a writer holding or waiting for the lock?
+  int readers;       // Number of readers holding the lock.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding the write lock.
+
+  // For lockstat:
+  struct lsclass *class;
+  uint64 tacquire;
+};
+
+// Reader-writer sleep lock.
+struct rwsleeplock {
+  struct spinlock lk; // spinlock protecting this sleep lock
+  int readers;       // Number of readers holding the lock.
+  int writer;        // Is a writer holding the lock?
+  int wwaiting;      // Number of writers waiting.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding the write lock.
+
+  // For adaptive spinning:
+  struct proc *owner; // Process holding the write lock.
+  int nsleepers;     // Processes sleeping for the lock.
+
+  // For lockstat:
+  struct lsclass *class;
+  uint64 tacquire;
+};
+
@@ -1,4 +1,10 @@
 // Sleeping locks
+//
+// Sleep locks are adaptive: a process that finds the lock held
+// by a process that is running on another CPU spins, since the
+// holder will likely release it soon, and a sleep and wakeup
+// would cost more than the wait. It sleeps only if the holder
+// is not running, for example because it is waiting for the disk.
 
 #include "types.h"
 #include "defs.h"
@@ -9,6 +15,10 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "lockstat.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_LOCK
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -18,18 +28,53 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->nsleepers = 0;
+  lk->class = lsregister(name, LS_SLEEP);
+}
+
+// Is p running on a CPU? Called without ptable.lock,
+// so the answer may be stale; callers only use it
+// to decide whether to keep spinning.
+int
+ownerrunning(struct proc *p)
+{
+  return p != 0 && *(volatile enum procstate*)&p->state == RUNNING;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int contended;
+  uint64 t0;
+  struct proc *owner;
+
   // 3cpu目からはspinするんかいな
   acquire(&lk->lk);
+  t0 = rdtsc();
+  contended = lk->locked;
   while (lk->locked) {
+    if(ownerrunning(owner = lk->owner)){
+      // Spin with interrupts on until the owner
+      // releases the lock or stops running.
+      release(&lk->lk);
+      while(*(volatile uint*)&lk->locked &&
+            *(struct proc* volatile*)&lk->owner == owner &&
+            ownerrunning(owner))
+        pause();
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nsleepers++;
     sleep(lk, &lk->lk);
+    lk->nsleepers--;
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  lk->tacquire = rdtsc();
+  lsacquire(lk->class, contended, contended ? lk->tacquire - t0 : 0,
+            (uint)__builtin_return_address(0));
   release(&lk->lk);
 }
 
@@ -37,9 +82,26 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lsrelease(lk->class, rdtsc() - lk->tacquire);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  // Spinning waiters will notice on their own;
+  // skip the ptable scan if nobody is asleep.
+  if(lk->nsleepers)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Hand lk from the current process over to an I/O request
+// that will release it when it completes, so that waiters
+// do not spin on the process and holdingsleep() fails.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->pid = 0;
+  lk->owner = 0;
   release(&lk->lk);
 }
 
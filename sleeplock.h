@@ -6,5 +6,13 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For adaptive spinning:
+  struct proc *owner; // Process holding lock
+  int nsleepers;     // Processes sleeping in acquiresleep
+
+  // For lockstat:
+  struct lsclass *class;
+  uint64 tacquire;
 };
 
@@ -8,6 +8,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -15,6 +16,7 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->class = lsregister(name, LS_SPIN);
 }
 
 // Acquire the lock.
@@ -24,13 +26,24 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int contended;
+  uint64 t0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // Time the spin only if the first try fails,
+  // so that uncontended acquires stay cheap.
+  contended = 0;
+  t0 = 0;
+  if(xchg(&lk->locked, 1) != 0){
+    contended = 1;
+    t0 = rdtsc();
+    while(xchg(&lk->locked, 1) != 0)
+      ;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +53,9 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  lk->tacquire = rdtsc();
+  lsacquire(lk->class, contended, contended ? lk->tacquire - t0 : 0,
+            lk->pcs[0]);
 }
 
 // Release the lock.
@@ -49,6 +65,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lsrelease(lk->class, rdtsc() - lk->tacquire);
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -124,3 +141,208 @@ popcli(void)
     sti();
 }
 
+
+//PAGEBREAK: 40
+// Lock statistics.
+//
+// Locks are grouped into classes by name, so that, for example,
+// all "buffer" sleep-locks share one set of counters. initlock()
+// and initsleeplock() register the class; acquire()/release()
+// and their sleep-lock counterparts record wait and hold times
+// measured with the TSC.
+//
+// Each class keeps separate counters per CPU. They are only
+// updated with interrupts off, so no locking is needed and
+// CPUs do not fight over the cache lines holding the counters.
+// lockstatcopy() adds them up for the lockstat() system call.
+
+struct lscpu {
+  uint nacquire;
+  uint ncontended;
+  uint64 waitcycles;
+  uint64 holdcycles;
+  uint waithist[NLSHIST];
+  uint holdhist[NLSHIST];
+  struct lssite site[NLSSITE];
+};
+
+struct lsclass {
+  char *name;
+  int type;
+  struct lscpu cpu[NCPU];
+};
+
+static struct lsclass lsclass[NLOCKSTAT];
+static uint lsclasslock;
+
+// Find or create the class for locks named name.
+// Called from initlock(), possibly before mycpu() works,
+// so the class table is protected by a bare xchg lock
+// with interrupts disabled by hand.
+// Returns 0 if the table is full; such locks are not counted.
+struct lsclass*
+lsregister(char *name, int type)
+{
+  struct lsclass *c, *empty;
+  uint eflags;
+
+  eflags = readeflags();
+  cli();
+  while(xchg(&lsclasslock, 1) != 0)
+    ;
+
+  empty = 0;
+  for(c = lsclass; c < &lsclass[NLOCKSTAT]; c++){
+    if(c->name == 0){
+      if(empty == 0)
+        empty = c;
+      continue;
+    }
+    if(c->type == type && strncmp(c->name, name, LSNAMESZ) == 0)
+      break;
+  }
+  if(c == &lsclass[NLOCKSTAT] && (c = empty) != 0){
+    c->name = name;
+    c->type = type;
+  }
+
+  xchg(&lsclasslock, 0);
+  if(eflags & FL_IF)
+    sti();
+  return c;
+}
+
+// Histogram bucket for a duration of n cycles: floor(log2(n)).
+static int
+lsbucket(uint64 n)
+{
+  uint hi, lo;
+  int b;
+
+  hi = n >> 32;
+  lo = n;
+  if(hi)
+    b = 32 + 31 - __builtin_clz(hi);
+  else if(lo)
+    b = 31 - __builtin_clz(lo);
+  else
+    b = 0;
+  return b < NLSHIST ? b : NLSHIST-1;
+}
+
+// Record an acquisition of a lock of class c from call site pc.
+// If the lock was contended, wait is the number of cycles spent
+// waiting for it. Interrupts must be off.
+void
+lsacquire(struct lsclass *c, int contended, uint64 wait, uint pc)
+{
+  struct lscpu *s;
+  struct lssite *site, *victim;
+
+  if(c == 0)
+    return;
+  s = &c->cpu[cpuid()];
+  s->nacquire++;
+  if(!contended)
+    return;
+  s->ncontended++;
+  s->waitcycles += wait;
+  s->waithist[lsbucket(wait)]++;
+
+  // Keep the busiest sites; a new site replaces the
+  // least contended one.
+  victim = s->site;
+  for(site = s->site; site < &s->site[NLSSITE]; site++){
+    if(site->pc == pc)
+      break;
+    if(site->ncontended < victim->ncontended)
+      victim = site;
+  }
+  if(site == &s->site[NLSSITE]){
+    site = victim;
+    site->pc = pc;
+    site->ncontended = 0;
+    site->waitcycles = 0;
+  }
+  site->ncontended++;
+  site->waitcycles += wait;
+}
+
+// Record that a lock of class c was held for hold cycles.
+// Interrupts must be off.
+void
+lsrelease(struct lsclass *c, uint64 hold)
+{
+  struct lscpu *s;
+
+  if(c == 0)
+    return;
+  s = &c->cpu[cpuid()];
+  s->holdcycles += hold;
+  s->holdhist[lsbucket(hold)]++;
+}
+
+// Merge a per-CPU call site into ls->site[].
+static void
+lsaddsite(struct lockstat *ls, struct lssite *from)
+{
+  struct lssite *site, *victim;
+
+  victim = ls->site;
+  for(site = ls->site; site < &ls->site[NLSSITE]; site++){
+    if(site->pc == from->pc)
+      break;
+    if(site->ncontended < victim->ncontended)
+      victim = site;
+  }
+  if(site == &ls->site[NLSSITE]){
+    if(victim->ncontended >= from->ncontended)
+      return;
+    site = victim;
+    site->pc = from->pc;
+    site->ncontended = 0;
+    site->waitcycles = 0;
+  }
+  site->ncontended += from->ncontended;
+  site->waitcycles += from->waitcycles;
+}
+
+// Copy the statistics of up to n lock classes into ls[],
+// summed over all CPUs. If reset is set, clear them afterwards.
+// Other CPUs keep counting while this runs, so a snapshot
+// may be slightly inconsistent; that is fine for profiling.
+// Returns the number of classes copied.
+int
+lockstatcopy(struct lockstat *ls, int n, int reset)
+{
+  struct lsclass *c;
+  struct lscpu *s;
+  int i, k;
+
+  k = 0;
+  for(c = lsclass; c < &lsclass[NLOCKSTAT] && k < n; c++){
+    if(c->name == 0)
+      continue;
+    memset(ls, 0, sizeof(*ls));
+    safestrcpy(ls->name, c->name, sizeof(ls->name));
+    ls->type = c->type;
+    for(s = c->cpu; s < &c->cpu[ncpu]; s++){
+      ls->nacquire += s->nacquire;
+      ls->ncontended += s->ncontended;
+      ls->waitcycles += s->waitcycles;
+      ls->holdcycles += s->holdcycles;
+      for(i = 0; i < NLSHIST; i++){
+        ls->waithist[i] += s->waithist[i];
+        ls->holdhist[i] += s->holdhist[i];
+      }
+      for(i = 0; i < NLSSITE; i++)
+        if(s->site[i].ncontended > 0)
+          lsaddsite(ls, &s->site[i]);
+      if(reset)
+        memset(s, 0, sizeof(*s));
+    }
+    ls++;
+    k++;
+  }
+  return k;
+}
@@ -103,6 +103,12 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_lockstat(void);
+extern int sys_iostat(void);
+extern int sys_loglevel(void);
+extern int sys_dmesg(void);
+extern int sys_mount(void);
+extern int sys_fcntl(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +132,12 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_lockstat] sys_lockstat,
+[SYS_iostat]  sys_iostat,
+[SYS_loglevel] sys_loglevel,
+[SYS_dmesg]   sys_dmesg,
+[SYS_mount]   sys_mount,
+[SYS_fcntl]   sys_fcntl,
 };
 
 void
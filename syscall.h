@@ -20,3 +20,9 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_lockstat 22
+#define SYS_iostat 23
+#define SYS_loglevel 24
+#define SYS_dmesg  25
+#define SYS_mount  26
+#define SYS_fcntl  27
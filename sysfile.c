@@ -13,8 +13,10 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iostat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -210,11 +212,12 @@ sys_unlink(void)
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
-  if(ip->type == T_DIR && !isdirempty(ip)){
+  if(ip->type == T_DIR && (!isdirempty(ip) || ismounted(ip))){
     iunlockput(ip);
     goto bad;
   }
 
+  dcacheremove(dp, name);
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
@@ -267,6 +270,7 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
+    dcachepurge(ip);
     dp->nlink++;  // for ".."
     iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
@@ -327,6 +331,9 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = 0;
+  f->rawin = 0;
+  f->ranext = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -442,3 +449,65 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Get or set the size of a pipe's buffer, as with
+// Linux's F_GETPIPE_SZ and F_SETPIPE_SZ. Returns the size.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(f->type != FD_PIPE)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
+}
+
+// Copy block I/O statistics to user space.
+int
+sys_iostat(void)
+{
+  struct iostat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  biostat(st);
+  return 0;
+}
+
+// Mount the file system on the named block device
+// (e.g. "hdc1") on a directory.
+int
+sys_mount(void)
+{
+  char *name, *path;
+  struct inode *ip;
+  int dev;
+
+  if(argstr(0, &name) < 0 || argstr(1, &path) < 0)
+    return -1;
+  if((dev = bdevlookup(name)) < 0)
+    return -1;
+  begin_op();
+  ip = namei(path);
+  end_op();
+  if(ip == 0)
+    return -1;
+  // Not in a transaction: attaching the file system's
+  // log waits for all FS system calls to finish.
+  if(fsmount(dev, ip) < 0){
+    begin_op();
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  return 0;
+}
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "loglevel.h"
 
 int
 sys_fork(void)
@@ -89,3 +91,57 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Copy lock statistics for up to n lock classes to user
+// space, clearing them if cmd is LS_RESET.
+// Returns the number of classes copied.
+int
+sys_lockstat(void)
+{
+  int cmd, n;
+  struct lockstat *ls;
+
+  if(argint(0, &cmd) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(cmd != LS_GET && cmd != LS_RESET)
+    return -1;
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  if(argptr(1, (void*)&ls, n*sizeof(*ls)) < 0)
+    return -1;
+  return lockstatcopy(ls, n, cmd == LS_RESET);
+}
+
+// Set the runtime log level of subsystem sys to level,
+// or of all subsystems if sys is -1, unless level is -1.
+// Returns the previous level of sys, or of subsystem 0.
+int
+sys_loglevel(void)
+{
+  int sys, level, old, i;
+
+  if(argint(0, &sys) < 0 || argint(1, &level) < 0)
+    return -1;
+  if(sys < -1 || sys >= NLOGSYS || level < -1 || level > LOG_NONE)
+    return -1;
+  old = loglevels[sys < 0 ? 0 : sys];
+  if(level >= 0){
+    for(i = 0; i < NLOGSYS; i++)
+      if(sys < 0 || i == sys)
+        loglevels[i] = level;
+  }
+  return old;
+}
+
+// Copy the kernel log, up to n-1 bytes, to user
+// space, 0-terminated. Returns the bytes copied.
+int
+sys_dmesg(void)
+{
+  char *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n <= 0 || argptr(0, &buf, n) < 0)
+    return -1;
+  return klogcopy(buf, n);
+}
@@ -6,6 +6,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "rwlock.h"
 #include "fs.h"
 #include "file.h"
 #include "mmu.h"
@@ -14,15 +15,56 @@
 
 #define COM1    0x3f8
 
+#define UART_TXSIZE 1024  // bytes queued for transmission
+#define UART_FIFO   16    // bytes the 16550 transmit FIFO holds
+
 static int uart;    // is there a uart?
 
+// Output is queued in tx and moved to the transmit FIFO
+// whenever it empties, which raises an interrupt, so that
+// uartputc() need not wait for the serial line. Once
+// polling is set, by panic(), output goes straight out.
+static struct {
+  struct spinlock lock;
+  char buf[UART_TXSIZE];
+  uint r;  // bytes read
+  uint w;  // bytes written
+  int polling;
+} tx;
+
+// Fill the transmit FIFO from tx, if it is empty.
+// Caller holds tx.lock.
+static void
+uartstart(void)
+{
+  int i;
+
+  if(!(inb(COM1+5) & 0x20))  // FIFO not empty yet
+    return;
+  for(i = 0; i < UART_FIFO && tx.r != tx.w; i++)
+    outb(COM1+0, tx.buf[tx.r++ % UART_TXSIZE]);
+}
+
+// Send c, waiting for the line.
+static void
+uartputcsync(int c)
+{
+  int i;
+
+  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
+    microdelay(10);
+  outb(COM1+0, c);
+}
+
 void
 uartinit(void)
 {
   char *p;
 
-  // Turn off the FIFO
-  outb(COM1+2, 0);
+  initlock(&tx.lock, "uart");
+
+  // Turn on the FIFOs, and clear them.
+  outb(COM1+2, 0x07);
 
   // 9600 baud, 8 data bits, 1 stop bit, parity off.
   outb(COM1+3, 0x80);    // Unlock divisor
@@ -30,7 +72,7 @@ uartinit(void)
   outb(COM1+1, 0);
   outb(COM1+3, 0x03);    // Lock divisor, 8 data bits.
   outb(COM1+4, 0);
-  outb(COM1+1, 0x01);    // Enable receive interrupts.
+  outb(COM1+1, 0x03);    // Enable receive and transmit interrupts.
 
   // If status is 0xFF, no serial port.
   if(inb(COM1+5) == 0xFF)
@@ -48,16 +90,35 @@ uartinit(void)
     uartputc(*p);
 }
 
+// Queue c for transmission. If the queue is full,
+// make room by waiting for the line.
 void
 uartputc(int c)
 {
-  int i;
+  if(!uart)
+    return;
+  if(tx.polling){
+    uartputcsync(c);
+    return;
+  }
+  acquire(&tx.lock);
+  while(tx.w - tx.r == UART_TXSIZE)
+    uartputcsync(tx.buf[tx.r++ % UART_TXSIZE]);
+  tx.buf[tx.w++ % UART_TXSIZE] = c;
+  uartstart();
+  release(&tx.lock);
+}
 
+// Send what is queued, and from now on send each
+// byte as it comes, without interrupts. For panic().
+void
+uartpoll(void)
+{
   if(!uart)
     return;
-  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-    microdelay(10);
-  outb(COM1+0, c);
+  tx.polling = 1;
+  while(tx.r != tx.w)
+    uartputcsync(tx.buf[tx.r++ % UART_TXSIZE]);
 }
 
 static int
@@ -73,5 +134,9 @@ uartgetc(void)
 void
 uartintr(void)
 {
+  inb(COM1+2);  // acknowledge a transmit interrupt
   consoleintr(uartgetc);
+  acquire(&tx.lock);
+  uartstart();
+  release(&tx.lock);
 }
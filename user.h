@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct iostat;
 
 // system calls
 int fork(void);
@@ -23,6 +25,12 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockstat(int, struct lockstat*, int);
+int iostat(struct iostat*);
+int loglevel(int, int);
+int dmesg(char*, int);
+int mount(char*, char*);
+int fcntl(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "lockstat.h"
+#include "iostat.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +186,10 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// 512-byte writes in the big file; enough
+// to need the double indirect block.
+#define NBIG ((NDIRECT + NINDIRECT) * (BSIZE/512) + 64)
+
 void
 writetest1(void)
 {
@@ -197,7 +203,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +223,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -354,6 +360,65 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// resize a pipe's buffer while it holds data
+void
+pipesize(void)
+{
+  int fds[2], i, n, size;
+
+  printf(1, "pipesize test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if((size = fcntl(fds[0], F_GETPIPE_SZ, 0)) <= 0){
+    printf(1, "pipesize: F_GETPIPE_SZ failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, 1000) != 1000){
+    printf(1, "pipesize: write failed\n");
+    exit();
+  }
+  // 8192 bytes, taking the stream across a page boundary.
+  if(fcntl(fds[1], F_SETPIPE_SZ, 5000) != 8192){
+    printf(1, "pipesize: F_SETPIPE_SZ failed\n");
+    exit();
+  }
+  for(n = 1000; n < 8000; n += 1000){
+    for(i = 0; i < 1000; i++)
+      buf[i] = n + i;
+    if(write(fds[1], buf, 1000) != 1000){
+      printf(1, "pipesize: write failed\n");
+      exit();
+    }
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 4096) >= 0){
+    printf(1, "pipesize: shrank below the buffered data\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 1 << 30) >= 0){
+    printf(1, "pipesize: grew too large\n");
+    exit();
+  }
+  close(fds[1]);
+  for(n = 0; (i = read(fds[0], buf, 3000)) > 0; n += i){
+    for(size = 0; size < i; size++){
+      if((buf[size] & 0xff) != ((n + size) & 0xff)){
+        printf(1, "pipesize: wrong data\n");
+        exit();
+      }
+    }
+  }
+  if(n != 8000){
+    printf(1, "pipesize: read %d bytes\n", n);
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "pipesize ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1724,6 +1789,234 @@ uio()
   printf(1, "uio test done\n");
 }
 
+// does lockstat() report the process table lock?
+void
+lockstattest(void)
+{
+  struct lockstat *ls;
+  int i, n;
+
+  printf(1, "lockstat test\n");
+  ls = malloc(NLOCKSTAT * sizeof(*ls));
+  if(lockstat(99, ls, NLOCKSTAT) != -1){
+    printf(1, "lockstat accepted a bad command\n");
+    exit();
+  }
+  n = lockstat(LS_GET, ls, NLOCKSTAT);
+  if(n <= 0 || n > NLOCKSTAT){
+    printf(1, "lockstat returned %d\n", n);
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, "ptable") == 0 && ls[i].type == LS_SPIN)
+      break;
+  if(i == n || ls[i].nacquire == 0){
+    printf(1, "lockstat: no ptable statistics\n");
+    exit();
+  }
+  free(ls);
+  printf(1, "lockstat test ok\n");
+}
+
+// several processes walking the same directories at once,
+// which now share the directory inode locks.
+void
+concurrentlookup(void)
+{
+  int i, j, pid, fd;
+  struct stat st;
+
+  printf(1, "concurrent lookup test\n");
+  if(mkdir("cl") < 0 || mkdir("cl/d") < 0){
+    printf(1, "concurrent lookup: mkdir failed\n");
+    exit();
+  }
+  fd = open("cl/d/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "concurrent lookup: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(j = 0; j < 100; j++){
+        if(stat("cl/d/f", &st) < 0 || st.type != T_FILE){
+          printf(1, "concurrent lookup: stat failed\n");
+          exit();
+        }
+        if(open("cl/d/nonexistent", 0) >= 0){
+          printf(1, "concurrent lookup: found nonexistent\n");
+          exit();
+        }
+        if(stat("/cl/../cl/./d", &st) < 0 || st.type != T_DIR){
+          printf(1, "concurrent lookup: dir stat failed\n");
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+
+  if(unlink("cl/d/f") < 0 || unlink("cl/d") < 0 || unlink("cl") < 0){
+    printf(1, "concurrent lookup: unlink failed\n");
+    exit();
+  }
+  printf(1, "concurrent lookup ok\n");
+}
+
+// Names that were looked up and not found must
+// be found once created, and not after removal.
+void
+dcachetest(void)
+{
+  int fd;
+
+  printf(1, "dcache test\n");
+  if(open("dc0", 0) >= 0){
+    printf(1, "dcache: dc0 exists\n");
+    exit();
+  }
+  fd = open("dc0", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "dcache: create dc0 failed\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("dc0", 0)) < 0){
+    printf(1, "dcache: created dc0 not found\n");
+    exit();
+  }
+  close(fd);
+
+  if(open("dc1", 0) >= 0 || link("dc0", "dc1") < 0){
+    printf(1, "dcache: link dc1 failed\n");
+    exit();
+  }
+  if((fd = open("dc1", 0)) < 0){
+    printf(1, "dcache: linked dc1 not found\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dc0") < 0 || unlink("dc1") < 0){
+    printf(1, "dcache: unlink failed\n");
+    exit();
+  }
+  if(open("dc0", 0) >= 0 || open("dc1", 0) >= 0){
+    printf(1, "dcache: unlinked name found\n");
+    exit();
+  }
+
+  // A directory created in place of a removed one is empty.
+  if(mkdir("dcd") < 0 || (fd = open("dcd/x", O_CREATE|O_RDWR)) < 0){
+    printf(1, "dcache: create dcd/x failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dcd/x") < 0 || unlink("dcd") < 0 || mkdir("dcd") < 0){
+    printf(1, "dcache: recreate dcd failed\n");
+    exit();
+  }
+  if(open("dcd/x", 0) >= 0){
+    printf(1, "dcache: dcd/x found in new dcd\n");
+    exit();
+  }
+  if(unlink("dcd") < 0){
+    printf(1, "dcache: unlink dcd failed\n");
+    exit();
+  }
+  printf(1, "dcache test ok\n");
+}
+
+// Sequential reads of a file, which start readahead,
+// must see the data that was written.
+void
+readaheadtest(void)
+{
+  struct iostat st0, st1;
+  int fd, i, j, n;
+
+  printf(1, "readahead test\n");
+  fd = open("ra", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "readahead: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 40; i++){
+    memset(buf, i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "readahead: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(iostat(&st0) < 0 || st0.nbuf < 1){
+    printf(1, "readahead: iostat failed\n");
+    exit();
+  }
+  fd = open("ra", 0);
+  for(i = 0; i < 40; i++){
+    // Odd sizes, so reads straddle blocks.
+    n = read(fd, buf, i == 0 ? 300 : 512);
+    if(n <= 0){
+      printf(1, "readahead: read failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("ra", 0);
+  for(i = 0; i < 40; i++){
+    if(read(fd, buf, 512) != 512){
+      printf(1, "readahead: reread failed\n");
+      exit();
+    }
+    for(j = 0; j < 512; j++)
+      if(buf[j] != (char)i){
+        printf(1, "readahead: wrong data\n");
+        exit();
+      }
+  }
+  close(fd);
+  if(iostat(&st1) < 0 || st1.nbread <= st0.nbread){
+    printf(1, "readahead: no bread statistics\n");
+    exit();
+  }
+  unlink("ra");
+  printf(1, "readahead test ok\n");
+}
+
+// The kernel log holds the messages logged while booting,
+// if any, one per line, each starting with a timestamp.
+void
+dmesgtest(void)
+{
+  int n;
+
+  printf(1, "dmesg test\n");
+  n = dmesg(buf, sizeof(buf));
+  if(n < 0 || n >= sizeof(buf) || buf[n] != 0){
+    printf(1, "dmesg: dmesg failed\n");
+    exit();
+  }
+  if(n > 0 && (buf[0] != '[' || buf[n-1] != '\n')){
+    printf(1, "dmesg: not whole lines\n");
+    exit();
+  }
+  if(dmesg(buf, 0) >= 0){
+    printf(1, "dmesg: accepted empty buffer\n");
+    exit();
+  }
+  printf(1, "dmesg test ok\n");
+}
+
 void argptest()
 {
   int fd;
@@ -1781,6 +2074,7 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipesize();
   preempt();
   exitwait();
 
@@ -1796,6 +2090,11 @@ main(int argc, char *argv[])
   bigdir(); // slow
 
   uio();
+  lockstattest();
+  concurrentlookup();
+  dcachetest();
+  readaheadtest();
+  dmesgtest();
 
   exectest();
 
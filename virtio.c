@@ -0,0 +1,246 @@
+// Driver for the virtio block device, which QEMU provides
+// with -device virtio-blk-pci.
+//
+// Unlike the IDE disk, the device takes many requests at once,
+// through a virtqueue of descriptors in memory it shares with
+// the driver, and finishes them in any order. A request is a
+// chain of descriptors: a header, one descriptor for each buf
+// of the request, and a status byte for the device to fill in.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "bdev.h"
+#include "pci.h"
+#include "virtio.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_DEV
+
+#define SECTOR_SIZE  512
+#define VQMAX        256  // largest queue the driver can set up
+
+// The queue, which must be physically contiguous and page aligned.
+static char vqmem[VRING_SIZE(VQMAX)] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  uint iobase;
+  uint nsect;       // size of the disk
+  uint qsize;       // entries in the queue
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  ushort usedidx;   // next entry of used to look at
+  uint nfree;       // free descriptors,
+  ushort free;      // ... linked through next
+
+  // For the request whose chain starts at descriptor i:
+  struct virtio_blkreq hdr[VQMAX];
+  uchar status[VQMAX];
+  struct buf *req[VQMAX];
+} vdisk;
+
+static void virtiointr(void);
+static void virtiorwstart(struct buf*);
+static void virtiorwwait(struct buf*);
+static struct bdevops virtioops = { virtiorwstart, virtiorwwait };
+
+// Set up the virtio disk, if there is one.
+void
+virtioinit(void)
+{
+  struct pcidev *p;
+  uint i, io;
+
+  if((p = pcilookup(VIRTIO_VENDOR, VIRTIO_DEV_BLK)) == 0)
+    return;
+  initlock(&vdisk.lock, "virtio");
+  pcienable(p);
+  io = vdisk.iobase = p->bar[0] & ~3;
+
+  outb(io+VIRTIO_STATUS, 0);  // reset
+  outb(io+VIRTIO_STATUS, VIRTIO_ACK);
+  outb(io+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER);
+  outl(io+VIRTIO_GUESTFEAT, 0);  // none of the optional features
+
+  // The device chooses the size of its queue.
+  outw(io+VIRTIO_QSEL, 0);
+  vdisk.qsize = inw(io+VIRTIO_QSIZE);
+  if(vdisk.qsize == 0 || vdisk.qsize > VQMAX){
+    log_warn("queue size %d", vdisk.qsize);
+    outb(io+VIRTIO_STATUS, VIRTIO_FAILED);
+    return;
+  }
+  vdisk.desc = (struct vring_desc*)vqmem;
+  vdisk.avail = (struct vring_avail*)(vqmem + 16*vdisk.qsize);
+  vdisk.used = (struct vring_used*)(vqmem + VRING_USED(vdisk.qsize));
+  for(i = 0; i < vdisk.qsize; i++)
+    vdisk.desc[i].next = i + 1;
+  vdisk.free = 0;
+  vdisk.nfree = vdisk.qsize;
+  outl(io+VIRTIO_QPFN, V2P(vqmem) >> PTXSHIFT);
+
+  // Capacity in sectors, 64 bits; the file system
+  // uses block numbers of 32 bits anyway.
+  vdisk.nsect = inl(io+VIRTIO_CONFIG);
+  if(inl(io+VIRTIO_CONFIG+4) != 0)
+    vdisk.nsect = 0xffffffff;
+
+  // Without interrupts every request would wait forever.
+  if(pcisetintr(p, virtiointr) < 0){
+    outb(io+VIRTIO_STATUS, VIRTIO_FAILED);
+    return;
+  }
+  outb(io+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER|VIRTIO_DRIVER_OK);
+
+  log_info("virtio disk, %d sectors, queue %d", vdisk.nsect, vdisk.qsize);
+  bdevadd("vda", &virtioops, 0, vdisk.nsect / (BSIZE/SECTOR_SIZE));
+}
+
+// Take a free descriptor. Caller holds vdisk.lock
+// and has checked that there is one.
+static uint
+dalloc(void)
+{
+  uint i;
+
+  i = vdisk.free;
+  vdisk.free = vdisk.desc[i].next;
+  vdisk.nfree--;
+  return i;
+}
+
+// Free the chain of descriptors starting at i.
+static void
+dfreechain(uint i)
+{
+  uint next;
+  int more;
+
+  do {
+    more = vdisk.desc[i].flags & VRING_NEXT;
+    next = vdisk.desc[i].next;
+    vdisk.desc[i].next = vdisk.free;
+    vdisk.free = i;
+    vdisk.nfree++;
+    i = next;
+  } while(more);
+}
+
+//PAGEBREAK!
+// Start a request for b, or for the chain of bufs
+// starting at b, and return without waiting for it;
+// like iderwstart(). Sleeps if the queue is full.
+static void
+virtiorwstart(struct buf *b)
+{
+  struct bdev *bd;
+  struct buf *m;
+  uint head, d, prev, n;
+
+  n = 2;
+  for(m = b; m; m = m->mnext){
+    if(!holdingsleep(&m->lock))
+      panic("virtiorw: buf not locked");
+    n++;
+  }
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  if(n > vdisk.qsize)
+    panic("virtiorw: request too big");
+  bd = bdevget(b->dev);
+  if(b->blockno >= bd->size || n - 2 > bd->size - b->blockno)
+    panic("virtiorw: block out of range");
+
+  acquire(&vdisk.lock);
+  while(vdisk.nfree < n)
+    sleep(&vdisk.nfree, &vdisk.lock);
+
+  // From here on the request owns the buffer locks.
+  for(m = b; m; m = m->mnext)
+    if(m->flags & B_ASYNC)
+      disownsleep(&m->lock);
+
+  head = dalloc();
+  vdisk.hdr[head].type = (b->flags & B_DIRTY) ? VIRTIO_BLK_OUT : VIRTIO_BLK_IN;
+  vdisk.hdr[head].reserved = 0;
+  vdisk.hdr[head].sector = (bd->start + b->blockno) * (BSIZE/SECTOR_SIZE);
+  vdisk.desc[head].addr = V2P(&vdisk.hdr[head]);
+  vdisk.desc[head].len = sizeof(vdisk.hdr[head]);
+  vdisk.desc[head].flags = VRING_NEXT;
+  prev = head;
+  for(m = b; m; m = m->mnext){
+    d = dalloc();
+    vdisk.desc[d].addr = V2P(m->data);
+    vdisk.desc[d].len = BSIZE;
+    vdisk.desc[d].flags = VRING_NEXT | ((b->flags & B_DIRTY) ? 0 : VRING_WRITE);
+    vdisk.desc[prev].next = d;
+    prev = d;
+  }
+  d = dalloc();
+  vdisk.status[head] = 0xff;
+  vdisk.desc[d].addr = V2P(&vdisk.status[head]);
+  vdisk.desc[d].len = 1;
+  vdisk.desc[d].flags = VRING_WRITE;
+  vdisk.desc[prev].next = d;
+  vdisk.req[head] = b;
+
+  // Publish the chain, then tell the device.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.qsize] = head;
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  outw(vdisk.iobase+VIRTIO_QNOTIFY, 0);
+
+  release(&vdisk.lock);
+}
+
+// Wait for the request for b, started with virtiorwstart(), to finish.
+static void
+virtiorwwait(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+// Interrupt handler: finish every request
+// the device has put in the used ring.
+static void
+virtiointr(void)
+{
+  struct buf *b, *m, *next;
+  uint id;
+
+  acquire(&vdisk.lock);
+  inb(vdisk.iobase+VIRTIO_ISR);  // acknowledge
+  __sync_synchronize();
+
+  while(vdisk.usedidx != *(volatile ushort*)&vdisk.used->idx){
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.qsize].id;
+    b = vdisk.req[id];
+    // There is no way to return an error to the caller,
+    // and biodone() would mark the bufs good.
+    if(vdisk.status[id] != 0)
+      panic("virtiointr: i/o error");
+    for(m = b; m; m = next){
+      next = m->mnext;
+      biodone(m);
+    }
+    vdisk.req[id] = 0;
+    dfreechain(id);
+    vdisk.usedidx++;
+  }
+  wakeup(&vdisk.nfree);
+
+  release(&vdisk.lock);
+}
@@ -0,0 +1,66 @@
+// Virtio devices through the legacy PCI interface
+// (virtio 0.9.5), and the queues they share with drivers.
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_DEV_BLK    0x1001  // block device, transitional id
+
+// Registers, in the I/O space of BAR 0.
+#define VIRTIO_HOSTFEAT   0x00  // features the device offers
+#define VIRTIO_GUESTFEAT  0x04  // features the driver uses
+#define VIRTIO_QPFN       0x08  // physical page number of the selected queue
+#define VIRTIO_QSIZE      0x0c  // (16 bit) entries in the selected queue
+#define VIRTIO_QSEL       0x0e  // (16 bit) select a queue
+#define VIRTIO_QNOTIFY    0x10  // (16 bit) queue that has new requests
+#define VIRTIO_STATUS     0x12  // (8 bit) device status
+#define VIRTIO_ISR        0x13  // (8 bit) interrupt status; reading clears it
+#define VIRTIO_CONFIG     0x14  // device-specific configuration
+
+// Device status bits.
+#define VIRTIO_ACK        1
+#define VIRTIO_DRIVER     2
+#define VIRTIO_DRIVER_OK  4
+#define VIRTIO_FAILED     128
+
+// A virtqueue holds a table of descriptors, each naming a piece of
+// memory, linked into chains; the available ring, where the driver
+// puts the heads of chains for the device to process; and the used
+// ring, where the device puts them back when it is done.
+struct vring_desc {
+  uint64 addr;   // physical address
+  uint len;
+  ushort flags;
+  ushort next;   // if flags has VRING_NEXT
+};
+#define VRING_NEXT        1  // the chain continues in next
+#define VRING_WRITE       2  // for the device to write, not read
+
+struct vring_avail {
+  ushort flags;
+  ushort idx;     // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vring_usedelem {
+  uint id;        // head of the chain
+  uint len;       // bytes the device wrote
+};
+
+struct vring_used {
+  ushort flags;
+  ushort idx;     // where the device puts the next entry
+  struct vring_usedelem ring[];
+};
+
+// Layout of a queue of n entries: descriptors, then the
+// available ring, then the used ring on the next page.
+#define VRING_USED(n)   PGROUNDUP(16*(n) + 6 + 2*(n))
+#define VRING_SIZE(n)   (VRING_USED(n) + PGROUNDUP(6 + 8*(n)))
+
+// Block device request header, and the types of request.
+struct virtio_blkreq {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+#define VIRTIO_BLK_IN     0  // read
+#define VIRTIO_BLK_OUT    1  // write
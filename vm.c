@@ -6,6 +6,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "loglevel.h"
+
+#define LOGSYS LOGSYS_VM
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()